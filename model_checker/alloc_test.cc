@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/counting_alloc.h"
+#include "model_checker/threadpool.h"
+
+// Its own test binary, since counting_alloc.cc replaces the global operator
+// new and delete.
+
+namespace model {
+
+TEST(ThreadPool, SteadyStatePathsDoNotAllocate)
+{
+  // check() runs on the worker, so it reads the worker's own count.  Only
+  // that worker touches these until run() returns.
+  size_t paths = 0;
+  size_t warm = 0;
+  size_t last = 0;
+  auto experiment = std::make_shared<ExperimentBuilder<std::vector<int>>>(
+      []() { return std::make_tuple(std::vector<int>(4)); },
+      [](RunnableActionSet &set, std::vector<int> &counts) {
+        for (int i = 0; i < 4; i++) {
+          set.add_action(
+              [](RunnableActionSet &set, std::vector<int> &counts,
+                 int i) -> Async {
+                co_await set.bg();
+                counts[i] += set.choice(2);
+                co_await set.bg();
+                counts[i]++;
+              },
+              counts, int{i});
+        }
+      },
+      [&paths, &warm, &last](ActionResult res, std::vector<int> &counts) {
+        if (++paths == 100) {
+          warm = allocations();
+        }
+        last = allocations();
+        return res == ActionResult::kOk && counts[0] >= 1;
+      });
+  experiment->set_reset([](std::vector<int> &counts) {
+    std::ranges::fill(counts, 0);
+  });
+
+  ThreadPool<std::vector<int>> pool(1);
+  EXPECT_TRUE(pool.run_test(experiment));
+  EXPECT_GT(paths, 1000);
+  EXPECT_EQ(last, warm);
+}
+
+} // namespace model
@@ -1,51 +1,451 @@
 #include "model_checker/async.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <coroutine>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace model {
 
-RunnableActionSet::~RunnableActionSet()
+namespace {
+
+struct FreeFrame {
+  FreeFrame *next;
+};
+
+struct FreeFrames {
+  std::array<FreeFrame *, FramePool::kMaxPooledSize / FramePool::kGranularity>
+      heads{};
+  std::array<size_t, FramePool::kMaxPooledSize / FramePool::kGranularity>
+      counts{};
+  size_t heap_allocations = 0;
+
+  FreeFrames() = default;
+  FreeFrames(const FreeFrames &) = delete;
+  FreeFrames &operator=(const FreeFrames &) = delete;
+  FreeFrames(FreeFrames &&) = delete;
+  FreeFrames &operator=(FreeFrames &&) = delete;
+
+  ~FreeFrames()
+  {
+    for (auto *head : heads) {
+      while (head != nullptr) {
+        auto *next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  }
+};
+
+thread_local FreeFrames free_frames;
+
+size_t
+size_class(size_t size)
+{
+  return (size - 1) / FramePool::kGranularity;
+}
+
+} // namespace
+
+void *
+FramePool::allocate(size_t size)
 {
-  for (auto &action : actions_) {
-    action.destroy();
+  if (size > kMaxPooledSize) {
+    return ::operator new(size);
+  }
+  size_t cls = size_class(size);
+  auto *&head = free_frames.heads[cls];
+  if (head != nullptr) {
+    auto *frame = head;
+    head = frame->next;
+    free_frames.counts[cls]--;
+    return frame;
   }
+  free_frames.heap_allocations++;
+  return ::operator new((cls + 1) * kGranularity);
 }
 
 void
-RunnableActionSet::run_next_decision()
+FramePool::deallocate(void *frame, size_t size) noexcept
 {
-  if (actions_.empty() || decision_count_ >= max_decisions_) {
+  if (size > kMaxPooledSize) {
+    ::operator delete(frame);
     return;
   }
+  size_t cls = size_class(size);
+  if (free_frames.counts[cls] >= kMaxFreeFrames) {
+    ::operator delete(frame);
+    return;
+  }
+  free_frames.heads[cls] = new (frame) FreeFrame{free_frames.heads[cls]};
+  free_frames.counts[cls]++;
+}
+
+size_t
+FramePool::heap_allocations()
+{
+  return free_frames.heap_allocations;
+}
+
+bool
+AccessSet::conflicts_with(const AccessSet &other) const
+{
+  if (!known_ || !other.known_) {
+    return true;
+  }
+  for (uint8_t i = 0; i < count_; i++) {
+    for (uint8_t j = 0; j < other.count_; j++) {
+      const auto &a = accesses_[i];
+      const auto &b = other.accesses_[j];
+      if (a.object == b.object && (a.is_write || b.is_write)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+RunnableActionSet::~RunnableActionSet()
+{
+  clear();
+}
+
+void
+RunnableActionSet::clear()
+{
+  for_each_ready(
+      [this](size_t /*choice*/, uint32_t id) { paused_[id].handle.destroy(); });
+  std::ranges::fill(ready_, 0);
+  ready_count_ = 0;
+}
+
+void
+RunnableActionSet::reset(WorkQueue &work_queue, size_t max_decisions)
+{
+  clear();
+  started_ = false;
+  pruned_ = false;
+  cancelled_ = false;
+  violated_ = false;
+  decision_count_ = 0;
+  max_decisions_ = max_decisions;
+  fresh_from_ = std::max<size_t>(work_queue.decision_count(), 1) - 1;
+  work_queue_ = &work_queue;
+  paused_.clear();
+  ready_.clear();
+  action_count_ = 0;
+  running_action_ = 0;
+  progress_.clear();
+  last_scheduled_ = std::nullopt;
+  preemptions_ = 0;
+  hit_preemption_bound_ = false;
+  states_ = nullptr;
+  state_hash_ = nullptr;
+  decision_hook_ = nullptr;
+  step_invariant_ = nullptr;
+  use_work_queue();
+  steps_.clear();
+  clocks_.clear();
+  sleeping_.clear();
+}
+
+bool
+RunnableActionSet::begin_decision()
+{
+  if (ready_count_ == 0 || decision_count_ >= max_decisions_ || pruned_ ||
+      cancelled_ || violated_) {
+    return false;
+  }
+  size_t idx = decision_count_;
+  if (work_queue_->cancelled() || (decision_hook_ && !decision_hook_(idx))) {
+    cancelled_ = true;
+    return false;
+  }
+
+  // States on a replayed prefix are in the table already.
+  if (states_ != nullptr && idx > fresh_from_ &&
+      !states_->insert(state_key())) {
+    pruned_ = true;
+    return false;
+  }
+  return true;
+}
+
+void
+RunnableActionSet::resume(uint8_t choice)
+{
+  decision_count_++;
+
+  uint32_t id = ready()[choice];
+  ready_[id / 64] &= ~(uint64_t{1} << (id % 64));
+  ready_count_--;
+  last_scheduled_ = id;
+
+  running_action_ = id;
+  // The action's next bg() overwrites its slot.
+  std::coroutine_handle<> handle = paused_[id].handle;
+  handle.resume();
+  check_invariant();
+}
+
+uint8_t
+RunnableActionSet::choose_with_bound(size_t height, size_t max_preemptions)
+{
+  // The last action to run can go on if it paused again rather than
+  // finishing.
+  const auto ready_actions = ready();
+  const auto n_opts = static_cast<uint8_t>(ready_actions.size());
+  if (!last_scheduled_ || !ready_actions.contains(*last_scheduled_)) {
+    return work_queue_->get_choice(height, n_opts);
+  }
+  const auto last =
+      static_cast<uint8_t>(ready_actions.index_of(*last_scheduled_));
+  if (preemptions_ >= max_preemptions) {
+    hit_preemption_bound_ |= n_opts > 1;
+    return work_queue_->get_fixed_choice(height, n_opts, last);
+  }
+  uint8_t choice = work_queue_->get_choice(height, n_opts);
+  if (choice != last) {
+    preemptions_++;
+  }
+  return choice;
+}
 
-  size_t idx = decision_count_++;
-  size_t action_count = actions_.size();
+// This is the source-DPOR of Abdulla et al., with sleep sets: whenever a step
+// runs for the first time after some prefix, every earlier step that it races
+// with asks for a backtrack point that lets the reversed race happen.
+std::optional<uint8_t>
+RunnableActionSet::choose_with_reduction(size_t height)
+{
+  if (clocks_.empty()) {
+    clocks_.assign(action_count_, std::vector<size_t>(action_count_, 0));
+  }
 
-  uint8_t next_choice = work_queue_.get_choice(idx, action_count);
+  uint32_t sleeping = 0;
+  std::optional<uint8_t> first;
+  for_each_ready([&](size_t i, uint32_t id) {
+    if (std::ranges::find(sleeping_, id) == sleeping_.end()) {
+      first = first.value_or(i);
+    }
+    else if (i < WorkQueue::kMaxBacktrackChoices) {
+      sleeping |= uint32_t{1} << i;
+    }
+  });
+  if (!first && height >= work_queue_->decision_count()) {
+    return std::nullopt;
+  }
+  uint8_t choice = work_queue_->get_backtrack_choice(
+      height, ready_count_, first.value_or(0), sleeping);
 
-  std::coroutine_handle<> action = actions_[next_choice];
-  actions_.erase(actions_.begin() + next_choice);
+  update_sleep_set(height, choice);
+  record_step(height, choice);
+  return choice;
+}
 
-  action.resume();
+void
+RunnableActionSet::update_sleep_set(size_t height, uint8_t choice)
+{
+  const PendingAction &chosen = paused_[ready()[choice]];
+  uint32_t explored = work_queue_->explored_before(height);
+  for_each_ready([&](size_t i, uint32_t id) {
+    if (i < WorkQueue::kMaxBacktrackChoices &&
+        (explored & (uint32_t{1} << i)) != 0 &&
+        std::ranges::find(sleeping_, id) == sleeping_.end()) {
+      sleeping_.push_back(id);
+    }
+  });
+  // An action stays asleep until something that it races with runs.
+  std::erase_if(sleeping_, [&](uint32_t id) {
+    if (id == chosen.id) {
+      return true;
+    }
+    assert(ready().contains(id));
+    return paused_[id].access.conflicts_with(chosen.access);
+  });
+}
+
+void
+RunnableActionSet::record_step(size_t height, uint8_t choice)
+{
+  const PendingAction &chosen = paused_[ready()[choice]];
+  Step step{.action = chosen.id,
+            .height = height,
+            .access = chosen.access,
+            .ready = {},
+            .clock = clocks_[chosen.id]};
+  step.ready.reserve(ready_count_);
+  for_each_ready(
+      [&step](size_t /*choice*/, uint32_t id) { step.ready.push_back(id); });
+  for (const auto &prev : steps_) {
+    if (prev.access.conflicts_with(step.access)) {
+      join(step.clock, prev.clock);
+    }
+  }
+
+  // Steps on a replayed prefix were analysed when they first ran.
+  if (height >= fresh_from_) {
+    // A conflicting step races with this one unless it happens before some
+    // later step that also happens before this one.
+    std::vector<size_t> covered = clocks_[chosen.id];
+    for (size_t i = steps_.size(); i-- > 0;) {
+      const Step &prev = steps_[i];
+      if (!prev.access.conflicts_with(step.access)) {
+        continue;
+      }
+      if (prev.action != chosen.id && covered[prev.action] <= i) {
+        add_backtrack(i, step);
+      }
+      join(covered, prev.clock);
+    }
+  }
+
+  step.clock[chosen.id] = steps_.size() + 1;
+  clocks_[chosen.id] = step.clock;
+  steps_.push_back(std::move(step));
+}
+
+void
+RunnableActionSet::add_backtrack(size_t race, const Step &next)
+{
+  // To reverse the race, some action has to go first at steps_[race] that
+  // starts the steps that do not depend on it, followed by `next`.
+  const Step &racing = steps_[race];
+  uint32_t candidates = 0;
+  auto add_candidate = [&](uint32_t action) {
+    auto it = std::ranges::find(racing.ready, action);
+    assert(it != racing.ready.end());
+    size_t idx = std::distance(racing.ready.begin(), it);
+    if (idx < WorkQueue::kMaxBacktrackChoices) {
+      candidates |= uint32_t{1} << idx;
+    }
+  };
+  // first_step[a] is the first step of action a that does not depend on the
+  // racing step, if any.
+  std::vector<std::optional<size_t>> first_step(action_count_);
+  auto is_initial = [&](const std::vector<size_t> &clock) {
+    for (size_t a = 0; a < action_count_; a++) {
+      if (first_step[a] && clock[a] > *first_step[a]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (size_t i = race + 1; i < steps_.size(); i++) {
+    const Step &step = steps_[i];
+    if (step.clock[racing.action] > race) {
+      continue;
+    }
+    if (is_initial(step.clock)) {
+      add_candidate(step.action);
+    }
+    if (!first_step[step.action]) {
+      first_step[step.action] = i;
+    }
+  }
+  if (is_initial(next.clock)) {
+    add_candidate(next.action);
+  }
+  work_queue_->add_backtrack(racing.height, candidates);
+}
+
+void
+RunnableActionSet::join(std::vector<size_t> &clock,
+                        const std::vector<size_t> &other)
+{
+  for (size_t a = 0; a < clock.size(); a++) {
+    clock[a] = std::max(clock[a], other[a]);
+  }
+}
+
+void
+RunnableActionSet::track_states(StateTable &states,
+                                std::function<uint64_t()> state_hash)
+{
+  assert(!started_);
+  assert(!work_queue_->options().partial_order_reduction);
+  states_ = &states;
+  state_hash_ = std::move(state_hash);
+}
+
+uint64_t
+RunnableActionSet::state_key() const
+{
+  // Summed, so that the order of the pending actions does not matter.
+  uint64_t pending = 0;
+  for_each_ready([&](size_t /*choice*/, uint32_t id) {
+    pending += hash_combine(id, paused_[id].step);
+  });
+  uint64_t key = hash_combine(state_hash_(), pending);
+  // With a decision limit, the same state deeper down has less of its
+  // subtree left to explore.
+  if (max_decisions_ != std::numeric_limits<size_t>::max()) {
+    key = hash_combine(key, decision_count_);
+  }
+  // Likewise with a preemption bound, where it also matters which action
+  // can go on without a preemption.
+  if (work_queue_->options().max_preemptions) {
+    key = hash_combine(key, preemptions_);
+    key = hash_combine(key, last_scheduled_.value_or(action_count_));
+  }
+  return key;
 }
 
 uint8_t
 RunnableActionSet::do_manual_choice(uint8_t option_count)
 {
-  return work_queue_.get_choice(decision_count_++, option_count);
+  return source_choice_(source_, decision_count_++, option_count,
+                        running_action_);
 }
 
 ActionResult
 RunnableActionSet::run()
 {
-  assert(decision_count_ == 0);
-  while (!actions_.empty() && decision_count_ < max_decisions_) {
-    run_next_decision();
+  const SearchOptions &options = work_queue_->options();
+  assert(!options.partial_order_reduction || !options.max_preemptions);
+  ExhaustiveSource source(*work_queue_);
+  if (!options.partial_order_reduction && !options.max_preemptions) {
+    return run(source);
+  }
+  use_source(source);
+  while (begin_decision()) {
+    if (options.partial_order_reduction) {
+      auto choice = choose_with_reduction(decision_count_);
+      if (!choice) {
+        pruned_ = true;
+        break;
+      }
+      resume(*choice);
+    }
+    else {
+      resume(choose_with_bound(decision_count_, *options.max_preemptions));
+    }
+  }
+  return result();
+}
+
+ActionResult
+RunnableActionSet::result() const
+{
+  if (violated_) {
+    return ActionResult::kInvariantViolated;
+  }
+  if (cancelled_) {
+    return ActionResult::kCancelled;
+  }
+  if (pruned_) {
+    return ActionResult::kPruned;
   }
-  if (actions_.empty()) {
+  if (ready_count_ == 0) {
     return ActionResult::kOk;
   }
   assert(decision_count_ == max_decisions_);
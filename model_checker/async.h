@@ -1,21 +1,54 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <concepts>
 #include <coroutine>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <limits>
+#include <optional>
+#include <span>
+#include <utility>
 #include <vector>
 
+#include "model_checker/state_table.h"
 #include "model_checker/work_queue.h"
 
 namespace model {
 
+// Coroutine frames come and go with every path, so each thread keeps the
+// freed ones around for the next path instead of returning them to the heap.
+// Frames are grouped into size classes; a frame freed on another thread than
+// the one that allocated it just moves to that thread's pool.
+class FramePool {
+public:
+  static void *allocate(size_t size);
+  static void deallocate(void *frame, size_t size) noexcept;
+
+  // The number of frames that this thread had to get from the heap.
+  static size_t heap_allocations();
+
+  static constexpr size_t kGranularity = 64;
+  static constexpr size_t kMaxPooledSize = 4096;
+  // Frames beyond this many per size class go back to the heap.
+  static constexpr size_t kMaxFreeFrames = 1024;
+};
+
 struct Async {
   // NOLINTBEGIN(readability-convert-member-functions-to-static)
   // NOLINTNEXTLINE(readability-identifier-naming)
   struct promise_type {
+    static void *operator new(size_t size) { return FramePool::allocate(size); }
+    static void operator delete(void *frame, size_t size) noexcept
+    {
+      FramePool::deallocate(frame, size);
+    }
+
     Async get_return_object() noexcept { return {}; }
     std::suspend_never initial_suspend() const noexcept { return {}; }
     void return_void() const noexcept {}
@@ -32,7 +65,174 @@ private:
   Async() noexcept = default;
 };
 
-enum class ActionResult { kOk = 0, kTimeout = 1 };
+// kPruned means that the search cut the path short because other paths cover
+// everything that could happen after it.  The final state means nothing then,
+// so it should not be checked.
+// kCancelled means that the work queue was cancelled (see
+// WorkQueue::set_cancel_flag()) before the path finished.  The final state
+// should not be checked either.
+// kInvariantViolated means that the step invariant (see
+// RunnableActionSet::set_step_invariant()) failed after the last step of the
+// path, which is then the shortest prefix that shows the violation.
+enum class ActionResult {
+  kOk = 0,
+  kTimeout = 1,
+  kPruned = 2,
+  kCancelled = 3,
+  kInvariantViolated = 4,
+};
+
+// A shared object that a step of an action reads or writes.  Only used by
+// partial order reduction (see SearchOptions): two steps are reordered only if
+// they touch the same object and at least one of them writes it.
+struct Access {
+  const void *object = nullptr;
+  bool is_write = false;
+
+  static Access read(const void *object) { return {object, false}; }
+  static Access write(const void *object) { return {object, true}; }
+};
+
+// Everything that one step touches.  A default-constructed AccessSet is
+// unknown and conflicts with every step, so that plain bg() calls stay sound
+// under partial order reduction.
+class AccessSet {
+public:
+  static constexpr size_t kMaxAccesses = 4;
+
+  AccessSet() = default;
+  // Written as bg(Access::read(&x)) or bg({Access::read(&x), ...}).
+  template<std::same_as<Access>... Rest>
+    requires(sizeof...(Rest) < kMaxAccesses)
+  AccessSet(Access first, Rest... rest)
+    : accesses_{first, rest...}, count_(1 + sizeof...(Rest)), known_(true)
+  {}
+  // An empty list: the step touches nothing shared.
+  static AccessSet none()
+  {
+    AccessSet set;
+    set.known_ = true;
+    return set;
+  }
+
+  bool conflicts_with(const AccessSet &other) const;
+
+private:
+  std::array<Access, kMaxAccesses> accesses_{};
+  uint8_t count_ = 0;
+  bool known_ = false;
+};
+
+// An action paused at a bg(), waiting for a scheduling decision to resume
+// it.
+struct PendingAction {
+  std::coroutine_handle<> handle;
+  uint32_t id;
+  // What the action touches once resumed.
+  AccessSet access;
+  // How many times the action paused before this one.
+  uint32_t step;
+};
+
+// The actions that a scheduling decision picks from, in choice order, which
+// is the order that the actions were added: a bitmask over action ids, 64 to
+// a word.  Picking the nth ready action only counts bits.
+class ReadyActions {
+public:
+  ReadyActions(std::span<const uint64_t> words, size_t count)
+    : words_(words), count_(count)
+  {}
+
+  size_t size() const { return count_; }
+  // The id of the action that `choice` picks.
+  uint32_t operator[](size_t choice) const
+  {
+    assert(choice < count_);
+    for (size_t w = 0;; w++) {
+      auto in_word = static_cast<size_t>(std::popcount(words_[w]));
+      if (choice < in_word) {
+        return w * 64 + nth_bit(words_[w], choice);
+      }
+      choice -= in_word;
+    }
+  }
+  // The choice that picks action `id`, which must be ready.
+  size_t index_of(uint32_t id) const
+  {
+    assert(contains(id));
+    size_t index = 0;
+    for (size_t w = 0; w < id / 64; w++) {
+      index += std::popcount(words_[w]);
+    }
+    return index + std::popcount(words_[id / 64] & low_bits(id % 64));
+  }
+  bool contains(uint32_t id) const
+  {
+    return id / 64 < words_.size() &&
+           (words_[id / 64] & (uint64_t{1} << (id % 64))) != 0;
+  }
+
+private:
+  static uint64_t low_bits(size_t n)
+  {
+    return n == 64 ? ~uint64_t{0} : (uint64_t{1} << n) - 1;
+  }
+  // The position of the nth set bit of `word`, by halving.
+  static uint32_t nth_bit(uint64_t word, size_t n)
+  {
+    uint32_t pos = 0;
+    for (size_t width = 32; width > 0; width /= 2) {
+      uint64_t low = word & low_bits(width);
+      auto in_low = static_cast<size_t>(std::popcount(low));
+      if (n < in_low) {
+        word = low;
+      }
+      else {
+        n -= in_low;
+        word >>= width;
+        pos += width;
+      }
+    }
+    return pos;
+  }
+
+  std::span<const uint64_t> words_;
+  size_t count_;
+};
+
+// Where RunnableActionSet::run(Source &) takes its choices from.  Both calls
+// return an option below the count that they are given, and see decisions in
+// order of height.  get_choice() is for choice() calls by `action`.
+template<typename T>
+concept ChoiceSource =
+    requires(T &source, size_t height, uint8_t option_count, uint32_t action,
+             const ReadyActions &ready) {
+      {
+        source.get_choice(height, option_count, action)
+      } -> std::convertible_to<uint8_t>;
+      {
+        source.get_action_choice(height, ready)
+      } -> std::convertible_to<uint8_t>;
+    };
+
+// Explores every path: takes each choice from a WorkQueue, which moves on to
+// the next path once this one is done.
+class ExhaustiveSource {
+public:
+  explicit ExhaustiveSource(WorkQueue &work_queue) : work_queue_(work_queue) {}
+
+  uint8_t get_choice(size_t height, uint8_t option_count, uint32_t /*action*/)
+  {
+    return work_queue_.get_choice(height, option_count);
+  }
+  uint8_t get_action_choice(size_t height, const ReadyActions &ready)
+  {
+    return work_queue_.get_choice(height, ready.size());
+  }
+
+private:
+  WorkQueue &work_queue_;
+};
 
 class RunnableActionSet;
 
@@ -44,8 +244,14 @@ class RunnableActionSet {
 public:
   RunnableActionSet(WorkQueue &work_queue,
                     size_t max_decisions = std::numeric_limits<size_t>::max())
-    : max_decisions_(max_decisions), work_queue_(work_queue)
-  {}
+    : max_decisions_(max_decisions),
+      // The deepest branch point of the queue is the one that just moved to
+      // a new choice.
+      fresh_from_(std::max<size_t>(work_queue.decision_count(), 1) - 1),
+      work_queue_(&work_queue)
+  {
+    use_work_queue();
+  }
 
   // disable copy and move
   RunnableActionSet(const RunnableActionSet &) = delete;
@@ -55,29 +261,85 @@ public:
 
   ~RunnableActionSet();
 
+  // Destroys the actions and puts the set back into the state that the
+  // constructor leaves it in, for the path that `work_queue` is on.  Keeps
+  // the memory that the last path needed, so that a set reused from path to
+  // path stops allocating once it has seen the largest path.
+  void reset(WorkQueue &work_queue,
+             size_t max_decisions = std::numeric_limits<size_t>::max());
+  // Destroys the actions that have not finished, for example because the
+  // state that they refer to is about to go away.
+  void clear();
+  // Sets the decision limit of a set that has not run yet.
+  void set_max_decisions(size_t max_decisions)
+  {
+    assert(!started_);
+    max_decisions_ = max_decisions;
+  }
+
   template<typename... Args>
   void add_action(is_captureless_lambda<Args...> auto action, Args &&...args)
   {
-    assert(decision_count_ == 0);
+    assert(!started_);
+    running_action_ = action_count_++;
+    progress_.push_back(0);
+    paused_.emplace_back();
+    if (action_count_ > ready_.size() * 64) {
+      ready_.push_back(0);
+    }
     action(*this, std::forward<Args>(args)...);
   }
 
-  [[nodiscard]] auto bg()
+  // Prunes every path that reaches a state that `states` already holds.  A
+  // state is `state_hash()` together with where each unfinished action is, so
+  // the hash has to cover everything that the actions share.  Must be called
+  // before run().  Not supported together with partial order reduction.
+  void track_states(StateTable &states,
+                    std::function<uint64_t()> state_hash);
+
+  // Called before each scheduling decision with its height.  If it returns
+  // false, the path stops there and run() returns kCancelled.
+  void set_decision_hook(std::function<bool(size_t height)> hook)
+  {
+    decision_hook_ = std::move(hook);
+  }
+
+  // Called once the actions are set up and after every step that a
+  // scheduling decision resumes, once the step has paused again or finished.
+  // If it returns false, the path stops there, so its subtree is never
+  // explored, and run() returns kInvariantViolated.  Not supported together
+  // with partial order reduction, which explores one order of independent
+  // steps, while the states in between depend on the order.
+  void set_step_invariant(std::function<bool()> invariant)
+  {
+    assert(!started_);
+    assert(!work_queue_->options().partial_order_reduction);
+    step_invariant_ = std::move(invariant);
+  }
+
+  // `access` describes what the action touches between resuming from this
+  // point and its next bg() (or its end).  It only matters with partial order
+  // reduction.
+  [[nodiscard]] auto bg(AccessSet access = {})
   {
     struct AwaitBackground {
       RunnableActionSet &set;
+      AccessSet access;
       // NOLINTNEXTLINE(readability-convert-member-functions-to-static)
       bool await_ready() noexcept { return false; }
+      // Control goes back to the resume() in run_next_decision(), and run()
+      // picks the next action from there, so the native stack stays flat
+      // however many steps the actions take.
       void await_suspend(std::coroutine_handle<> h) const noexcept
       {
-        set.actions_.push_back(h);
-        if (set.decision_count_ != 0) {
-          set.run_next_decision();
-        }
+        uint32_t id = set.running_action_;
+        set.paused_[id] = {h, id, access, set.progress_[id]++};
+        set.ready_[id / 64] |= uint64_t{1} << (id % 64);
+        set.ready_count_++;
       }
       void await_resume() const noexcept {}
     };
-    return AwaitBackground(*this);
+    return AwaitBackground(*this, access);
   }
 
   // Does not pause the coroutine.  Just executes a choice (with a given branch
@@ -88,16 +350,152 @@ public:
     return do_manual_choice(option_count);
   }
 
+  // Runs the path that the work queue is on.
   ActionResult run();
+  // Takes every choice from `source` instead of the work queue, which only
+  // still cancels the path.  The source is called directly, so that it can
+  // be inlined into the scheduling loop.  Not supported together with
+  // partial order reduction or a preemption bound, which choose with the
+  // work queue.
+  template<ChoiceSource Source> ActionResult run(Source &source)
+  {
+    assert(!work_queue_->options().partial_order_reduction &&
+           !work_queue_->options().max_preemptions);
+    use_source(source);
+    while (begin_decision()) {
+      resume(source.get_action_choice(decision_count_, ready()));
+    }
+    return result();
+  }
+
+  // The number of preemptions on the path so far: scheduling decisions that
+  // switched away from an action that could have kept running.
+  size_t preemptions() const { return preemptions_; }
+  // Whether SearchOptions::max_preemptions kept some decision on the path
+  // from switching actions, so that a higher bound explores more paths.
+  bool hit_preemption_bound() const { return hit_preemption_bound_; }
 
 private:
-  void run_next_decision();
+  // A scheduling decision on the current path, as seen by partial order
+  // reduction.
+  struct Step {
+    uint32_t action;
+    size_t height;
+    AccessSet access;
+    // Ids of the actions that were ready, in choice order.
+    std::vector<uint32_t> ready;
+    // clock[a] is one past the index of the last step of action a that
+    // happens before (or is) this step.
+    std::vector<size_t> clock;
+  };
+
+  // Until run() picks a source, choice() calls (by actions that choose
+  // before their first bg()) go to the work queue, or to the source that it
+  // hands on (see WorkQueue::set_choice_source()).
+  void use_work_queue()
+  {
+    if (const auto &hook = work_queue_->choice_hook(); hook.source) {
+      source_ = hook.source;
+      source_choice_ = hook.choose;
+      return;
+    }
+    source_ = work_queue_;
+    source_choice_ = [](void *source, size_t height, uint8_t option_count,
+                        uint32_t /*action*/) -> uint8_t {
+      return static_cast<WorkQueue *>(source)->get_choice(height,
+                                                          option_count);
+    };
+  }
+  template<ChoiceSource Source> void use_source(Source &source)
+  {
+    assert(!started_);
+    started_ = true;
+    source_ = &source;
+    source_choice_ = [](void *source, size_t height, uint8_t option_count,
+                        uint32_t action) -> uint8_t {
+      return static_cast<Source *>(source)->get_choice(height, option_count,
+                                                       action);
+    };
+    check_invariant();
+  }
+  void check_invariant()
+  {
+    if (step_invariant_ && !step_invariant_()) {
+      violated_ = true;
+    }
+  }
+  ReadyActions ready() const { return ReadyActions(ready_, ready_count_); }
+  // Calls `f(choice, id)` for each ready action, in choice order.
+  template<typename F> void for_each_ready(F &&f) const
+  {
+    size_t choice = 0;
+    for (size_t w = 0; w < ready_.size(); w++) {
+      for (uint64_t bits = ready_[w]; bits != 0; bits &= bits - 1) {
+        f(choice++, static_cast<uint32_t>(w * 64 + std::countr_zero(bits)));
+      }
+    }
+  }
+  // Returns whether the path goes on to another scheduling decision.
+  bool begin_decision();
+  // Resumes the ready action at `choice`.
+  void resume(uint8_t choice);
+  ActionResult result() const;
   uint8_t do_manual_choice(uint8_t option_count);
+  uint64_t state_key() const;
 
+  // Picks the next action under a preemption bound.
+  uint8_t choose_with_bound(size_t height, size_t max_preemptions);
+
+  // Picks the next action under partial order reduction.  Returns nullopt if
+  // every ready action is asleep.
+  std::optional<uint8_t> choose_with_reduction(size_t height);
+  void update_sleep_set(size_t height, uint8_t choice);
+  // Appends the chosen step to steps_, adding the backtrack points for the
+  // races that it completes.
+  void record_step(size_t height, uint8_t choice);
+  void add_backtrack(size_t race, const Step &next);
+  static void join(std::vector<size_t> &clock,
+                   const std::vector<size_t> &other);
+
+  // Whether run() has started.
+  bool started_ = false;
+  bool pruned_ = false;
+  bool cancelled_ = false;
+  bool violated_ = false;
   size_t decision_count_ = 0;
   size_t max_decisions_ = 0;
-  WorkQueue &work_queue_;
-  std::vector<std::coroutine_handle<>> actions_;
+  // Branch points below this height replay a path that was already analysed.
+  size_t fresh_from_ = 0;
+  WorkQueue *work_queue_;
+  // Per action, where it is paused, if its bit in ready_ is set.
+  std::vector<PendingAction> paused_;
+  // The actions that are paused at a bg() (see ReadyActions).
+  std::vector<uint64_t> ready_;
+  size_t ready_count_ = 0;
+  uint32_t action_count_ = 0;
+  uint32_t running_action_ = 0;
+  // Per action, the number of times it paused so far.
+  std::vector<uint32_t> progress_;
+  // The action picked by the last scheduling decision, if any.
+  std::optional<uint32_t> last_scheduled_;
+  size_t preemptions_ = 0;
+  bool hit_preemption_bound_ = false;
+
+  StateTable *states_ = nullptr;
+  std::function<uint64_t()> state_hash_;
+  std::function<bool(size_t)> decision_hook_;
+  std::function<bool()> step_invariant_;
+  // The source of the run, for choice() calls.
+  void *source_ = nullptr;
+  uint8_t (*source_choice_)(void *source, size_t height, uint8_t option_count,
+                            uint32_t action) = nullptr;
+
+  std::vector<Step> steps_;
+  // Per action, the clock of its most recent step.
+  std::vector<std::vector<size_t>> clocks_;
+  // Actions whose next step would only lead to interleavings that are
+  // explored elsewhere (Godefroid's sleep sets).
+  std::vector<uint32_t> sleeping_;
 };
 
 } // namespace model
@@ -1,9 +1,17 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <numeric>
+#include <set>
+#include <tuple>
+#include <vector>
 
 #include "model_checker/async.h"
+#include "model_checker/state_table.h"
 #include "model_checker/work_queue.h"
 
 namespace model {
@@ -193,7 +201,7 @@ TEST(Async, ManualChoice)
     int x = 0, y = 0, z = 0;
 
     set.add_action(
-        [](RunnableActionSet &set, int &x, int &y, int &z) -> Async {
+        [](RunnableActionSet &set, int &x, int &y, int & /*z*/) -> Async {
           co_await set.bg();
           auto choice = set.choice(2);
           if (choice) {
@@ -240,4 +248,373 @@ TEST(Async, ManualChoice)
   }
 }
 
+// Always takes the last option, and records what it was asked.
+struct LastChoiceSource {
+  uint8_t get_choice(size_t height, uint8_t option_count, uint32_t action)
+  {
+    heights.push_back(height);
+    choosers.push_back(action);
+    return option_count - 1;
+  }
+  uint8_t get_action_choice(size_t height, const ReadyActions &ready)
+  {
+    heights.push_back(height);
+    choosers.push_back(ready[ready.size() - 1]);
+    return ready.size() - 1;
+  }
+
+  std::vector<size_t> heights;
+  // The action that chose, or was chosen.
+  std::vector<uint32_t> choosers;
+};
+static_assert(ChoiceSource<LastChoiceSource>);
+static_assert(ChoiceSource<ExhaustiveSource>);
+
+TEST(Async, ChoiceSource)
+{
+  WorkQueue work_queue;
+  RunnableActionSet set(work_queue);
+  std::vector<int> log;
+  auto action = [](RunnableActionSet &set, std::vector<int> &log,
+                   int i) -> Async {
+    co_await set.bg();
+    log.push_back(i * 10 + set.choice(3));
+  };
+  set.add_action(action, log, 0);
+  set.add_action(action, log, 1);
+
+  LastChoiceSource source;
+  ASSERT_EQ(set.run(source), ActionResult::kOk);
+  EXPECT_EQ(log, (std::vector<int>{12, 2}));
+  EXPECT_EQ(source.heights, (std::vector<size_t>{0, 1, 2, 3}));
+  EXPECT_EQ(source.choosers, (std::vector<uint32_t>{1, 1, 0, 0}));
+  // The work queue was not asked.
+  EXPECT_EQ(work_queue.decision_count(), 0);
+}
+
+TEST(Async, ChoiceBeforeFirstBg)
+{
+  WorkQueue work_queue;
+  std::set<std::vector<int>> outcomes;
+  size_t paths = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+    std::vector<int> log;
+    set.add_action(
+        [](RunnableActionSet &set, std::vector<int> &log) -> Async {
+          int picked = set.choice(3);
+          co_await set.bg();
+          log.push_back(picked);
+        },
+        log);
+    set.add_action(
+        [](RunnableActionSet &set, std::vector<int> &log) -> Async {
+          co_await set.bg();
+          log.push_back(10);
+        },
+        log);
+    ASSERT_EQ(set.run(), ActionResult::kOk);
+    outcomes.insert(log);
+    paths++;
+    work_queue.advance_cursor();
+  }
+  // Three choices, each followed by two orders of the steps.
+  EXPECT_EQ(paths, 6);
+  EXPECT_EQ(outcomes.size(), 6);
+}
+
+TEST(Async, LongTraceDoesNotGrowTheStack)
+{
+  WorkQueue work_queue;
+  RunnableActionSet set(work_queue);
+  int value = 0;
+  set.add_action(
+      [](RunnableActionSet &set, int &value) -> Async {
+        for (int i = 0; i < 1'000'000; i++) {
+          co_await set.bg();
+          value++;
+        }
+      },
+      value);
+
+  ASSERT_EQ(set.run(), ActionResult::kOk);
+  EXPECT_EQ(value, 1'000'000);
+  EXPECT_EQ(work_queue.decision_count(), 1'000'000);
+}
+
+TEST(Async, CancelStopsThePath)
+{
+  std::atomic<bool> cancelled = false;
+  WorkQueue work_queue;
+  work_queue.set_cancel_flag(&cancelled);
+  RunnableActionSet set(work_queue);
+  int value = 0;
+  set.add_action(
+      [](RunnableActionSet &set, int &value,
+         std::atomic<bool> &cancelled) -> Async {
+        for (int i = 0; i < 1000; i++) {
+          co_await set.bg();
+          value++;
+          if (value == 10) {
+            cancelled = true;
+          }
+        }
+      },
+      value, cancelled);
+
+  EXPECT_EQ(set.run(), ActionResult::kCancelled);
+  EXPECT_EQ(value, 10);
+  work_queue.advance_cursor();
+  EXPECT_TRUE(work_queue.done());
+}
+
+TEST(Async, FramePoolReusesFrames)
+{
+  WorkQueue work_queue;
+  size_t heap_allocations = 0;
+  size_t loop_iters = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+    int value = 0;
+    for (int i = 0; i < 3; i++) {
+      set.add_action(
+          [](RunnableActionSet &set, int &value) -> Async {
+            co_await set.bg();
+            value++;
+          },
+          value);
+    }
+    ASSERT_EQ(set.run(), ActionResult::kOk);
+
+    // Only the first path needs new frames.
+    if (loop_iters == 0) {
+      heap_allocations = FramePool::heap_allocations();
+    }
+    EXPECT_EQ(FramePool::heap_allocations(), heap_allocations);
+
+    loop_iters++;
+    work_queue.advance_cursor();
+  }
+  EXPECT_EQ(loop_iters, 6);
+}
+
+TEST(Async, PartialOrderReductionIndependentSteps)
+{
+  WorkQueue work_queue(SearchOptions{.partial_order_reduction = true});
+  size_t loop_iters = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+    std::array<int, 3> values = {0, 0, 0};
+
+    for (auto &value : values) {
+      set.add_action(
+          [](RunnableActionSet &set, int &value) -> Async {
+            co_await set.bg(Access::write(&value));
+            value += 1;
+            co_await set.bg(Access::write(&value));
+            value *= 3;
+          },
+          value);
+    }
+
+    ASSERT_EQ(set.run(), ActionResult::kOk);
+    EXPECT_EQ(values, (std::array<int, 3>{3, 3, 3}));
+
+    loop_iters++;
+    work_queue.advance_cursor();
+  }
+  // Without reduction, this would be 6!/(2!2!2!) = 90 interleavings.
+  EXPECT_EQ(loop_iters, 1);
+}
+
+TEST(Async, PartialOrderReductionReadsCommute)
+{
+  WorkQueue work_queue(SearchOptions{.partial_order_reduction = true});
+  size_t loop_iters = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+    int x = 1, y = 0;
+
+    // Only the order of the write to x and the read of x matters:
+    // A before B1, or B1 before A.
+    set.add_action(
+        [](RunnableActionSet &set, int &x, int & /*unused*/) -> Async {
+          co_await set.bg(Access::write(&x));
+          x = 2;
+        },
+        x, y);
+    set.add_action(
+        [](RunnableActionSet &set, int &x, int &y) -> Async {
+          int seen = 0;
+          co_await set.bg(Access::read(&x));
+          seen = x;
+          co_await set.bg(Access::write(&y));
+          y = seen;
+        },
+        x, y);
+
+    ASSERT_EQ(set.run(), ActionResult::kOk);
+
+    loop_iters++;
+    work_queue.advance_cursor();
+  }
+  EXPECT_EQ(loop_iters, 2);
+}
+
+TEST(Async, PartialOrderReductionReachesSameStates)
+{
+  auto explore = [](SearchOptions options) {
+    std::set<std::tuple<int, int, int>> outcomes;
+    WorkQueue work_queue(options);
+    while (!work_queue.done()) {
+      RunnableActionSet set(work_queue);
+      int x = 0, y = 0, z = 0;
+
+      set.add_action(
+          [](RunnableActionSet &set, int &x, int &y, int & /*unused*/)
+              -> Async {
+            co_await set.bg(Access::write(&x));
+            x += 1;
+            co_await set.bg({Access::read(&x), Access::write(&y)});
+            y = x * 10;
+          },
+          x, y, z);
+      set.add_action(
+          [](RunnableActionSet &set, int &x, int & /*unused*/, int &z)
+              -> Async {
+            co_await set.bg(Access::write(&z));
+            z = set.choice(2) + 1;
+            co_await set.bg({Access::read(&z), Access::write(&x)});
+            x *= z;
+          },
+          x, y, z);
+      set.add_action(
+          [](RunnableActionSet &set, int & /*unused*/, int &y, int &z)
+              -> Async {
+            co_await set.bg(Access::read(&y));
+            int seen = y;
+            co_await set.bg(Access::write(&z));
+            z += seen;
+          },
+          x, y, z);
+
+      // Paths that only lead to interleavings explored elsewhere are pruned.
+      auto res = set.run();
+      EXPECT_NE(res, ActionResult::kTimeout);
+      if (res == ActionResult::kOk) {
+        outcomes.emplace(x, y, z);
+      }
+      work_queue.advance_cursor();
+    }
+    return outcomes;
+  };
+
+  auto reduced = explore(SearchOptions{.partial_order_reduction = true});
+  auto full = explore(SearchOptions{});
+  EXPECT_EQ(reduced, full);
+}
+
+TEST(Async, PartialOrderReductionUnannotatedStepsConflict)
+{
+  WorkQueue work_queue(SearchOptions{.partial_order_reduction = true});
+  size_t loop_iters = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+
+    set.add_action([](RunnableActionSet &set) -> Async {
+      co_await set.bg();
+      co_await set.bg();
+    });
+    set.add_action([](RunnableActionSet &set) -> Async {
+      co_await set.bg();
+      co_await set.bg();
+    });
+
+    ASSERT_EQ(set.run(), ActionResult::kOk);
+
+    loop_iters++;
+    work_queue.advance_cursor();
+  }
+  EXPECT_EQ(loop_iters, 6);
+}
+
+TEST(Async, StatefulExplorationPrunesRevisitedStates)
+{
+  VisitedStateTable states(1024);
+  WorkQueue work_queue;
+  size_t completed = 0;
+  size_t pruned = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+    int value = 0;
+
+    for (int i = 0; i < 3; i++) {
+      set.add_action(
+          [](RunnableActionSet &set, int &value) -> Async {
+            co_await set.bg();
+            value += 1;
+            co_await set.bg();
+            value += 1;
+          },
+          value);
+    }
+    set.track_states(states, [&value] { return value; });
+
+    auto res = set.run();
+    if (res == ActionResult::kOk) {
+      EXPECT_EQ(value, 6);
+      completed++;
+    }
+    else {
+      ASSERT_EQ(res, ActionResult::kPruned);
+      pruned++;
+    }
+    work_queue.advance_cursor();
+  }
+  // Without the table, this would be 6!/(2!2!2!) = 90 interleavings.  With
+  // it, each of the 3^3 = 27 combinations of how far each action got is
+  // expanded once, except that the last step into the final state is taken
+  // from each of its 3 predecessors.
+  EXPECT_EQ(completed, 3);
+  EXPECT_EQ(pruned, 26);
+  EXPECT_EQ(states.size(), 25);
+}
+
+TEST(Async, PreemptionBoundLimitsSwitches)
+{
+  // Counts the paths with each number of preemptions, out of every path of
+  // two actions with three steps each.
+  auto explore = [](size_t bound) {
+    std::vector<size_t> paths;
+    WorkQueue work_queue(SearchOptions{.max_preemptions = bound});
+    while (!work_queue.done()) {
+      RunnableActionSet set(work_queue);
+      for (int i = 0; i < 2; i++) {
+        set.add_action([](RunnableActionSet &set) -> Async {
+          co_await set.bg();
+          co_await set.bg();
+          co_await set.bg();
+        });
+      }
+      EXPECT_EQ(set.run(), ActionResult::kOk);
+      EXPECT_LE(set.preemptions(), bound);
+      paths.resize(std::max(paths.size(), set.preemptions() + 1));
+      paths[set.preemptions()]++;
+      work_queue.advance_cursor();
+    }
+    return paths;
+  };
+
+  // 6!/(3!3!) = 20 interleavings in all.
+  auto all = explore(100);
+  EXPECT_EQ(std::accumulate(all.begin(), all.end(), size_t{0}), 20);
+  // Without preemptions, whichever action goes first runs to the end.
+  EXPECT_EQ(all[0], 2);
+  for (size_t bound = 0; bound < all.size(); bound++) {
+    auto bounded = explore(bound);
+    EXPECT_EQ(bounded,
+              std::vector<size_t>(all.begin(), all.begin() + bound + 1));
+  }
+}
+
 } // namespace model
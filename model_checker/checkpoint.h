@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+// An action written as a state machine instead of a coroutine, so that it can
+// be copied halfway through.  step() runs the action up to its next switch
+// point (what an Async action does between two bg() calls) and returns
+// whether the action has more steps.
+template<typename A, typename State>
+concept CheckpointableAction =
+    std::copyable<A> && requires(A &action, State &state) {
+      { action.step(state) } -> std::same_as<bool>;
+    };
+
+// Explores the paths of a WorkQueue like a RunnableActionSet, but copies the
+// state and the actions at branch points, so that each path resumes from the
+// deepest copy that is still on it instead of replaying the whole path from
+// the start.  Near the leaves, a path then costs a few steps instead of the
+// depth of the tree.
+//
+// Choices are numbered as for a RunnableActionSet whose actions call bg()
+// before every step, so the two find the same paths.  Partial order reduction,
+// state tracking and choice() are not supported.
+//
+// Keep one CheckpointedActionSet per thread and run every path of a queue
+// through it:
+//
+//   CheckpointedActionSet<State, Action> set(initial, actions);
+//   while (!work_queue.done()) {
+//     auto res = set.run(work_queue);
+//     check(res, set.state());
+//     work_queue.advance_cursor();
+//   }
+//
+// or let a ThreadPool do that on each of its workers (see
+// checkpointed_experiment()).
+template<std::copyable State, CheckpointableAction<State> Action>
+class CheckpointedActionSet {
+public:
+  // Copies are taken every `checkpoint_interval` decisions, trading memory
+  // and copying for replay.
+  CheckpointedActionSet(
+      State initial_state, std::vector<Action> actions,
+      size_t checkpoint_interval = 1,
+      size_t max_decisions = std::numeric_limits<size_t>::max())
+    : checkpoint_interval_(std::max<size_t>(checkpoint_interval, 1)),
+      max_decisions_(max_decisions), state_(initial_state)
+  {
+    checkpoints_.push_back(
+        Checkpoint{0, 1, std::move(initial_state), std::move(actions)});
+    live_ = 1;
+  }
+
+  // Runs the current path of `work_queue`.  Afterwards, state() is the state
+  // at the end of the path.
+  ActionResult run(WorkQueue &work_queue)
+  {
+    assert(!work_queue.options().partial_order_reduction);
+    // The checkpoints of another queue are not on its paths, except for the
+    // initial state.
+    size_t unchanged = &work_queue == last_queue_
+                           ? work_queue.unchanged_prefix()
+                           : 0;
+    last_queue_ = &work_queue;
+    while (checkpoints_[live_ - 1].height > unchanged) {
+      live_--;
+    }
+
+    const Checkpoint &resume = checkpoints_[live_ - 1];
+    size_t height = resume.height;
+    state_ = resume.state;
+    actions_ = resume.actions;
+    if (height > 0) {
+      // The choices below the checkpoint are not made again, so they do not
+      // divide the path's weight.
+      work_queue.restore_path_weight(resume.path_weight);
+    }
+
+    while (!actions_.empty()) {
+      if (height >= max_decisions_) {
+        return ActionResult::kTimeout;
+      }
+      if (work_queue.cancelled()) {
+        return ActionResult::kCancelled;
+      }
+      if (height % checkpoint_interval_ == 0 &&
+          height > checkpoints_[live_ - 1].height) {
+        push_checkpoint(height, work_queue.path_weight());
+      }
+
+      uint8_t choice = work_queue.get_choice(height, actions_.size());
+      height++;
+      steps_++;
+      // Actions keep their place, as in a RunnableActionSet.
+      if (!actions_[choice].step(state_)) {
+        actions_.erase(actions_.begin() + choice);
+      }
+    }
+    return ActionResult::kOk;
+  }
+
+  State &state() { return state_; }
+
+  // The number of steps run so far, over all paths.
+  size_t steps() const { return steps_; }
+
+private:
+  struct Checkpoint {
+    // The number of decisions made before the copy was taken.
+    size_t height;
+    // WorkQueue::path_weight() after those decisions.
+    double path_weight;
+    State state;
+    // The unfinished actions, in choice order.
+    std::vector<Action> actions;
+  };
+
+  void push_checkpoint(size_t height, double path_weight)
+  {
+    // Checkpoints past live_ were left by earlier paths.  Assigning over them
+    // reuses their memory.
+    if (live_ == checkpoints_.size()) {
+      checkpoints_.push_back(
+          Checkpoint{height, path_weight, state_, actions_});
+    }
+    else {
+      checkpoints_[live_].height = height;
+      checkpoints_[live_].path_weight = path_weight;
+      checkpoints_[live_].state = state_;
+      checkpoints_[live_].actions = actions_;
+    }
+    live_++;
+  }
+
+  size_t checkpoint_interval_;
+  size_t max_decisions_;
+  // checkpoints_[0] is the initial state, and is always live.
+  std::vector<Checkpoint> checkpoints_;
+  size_t live_ = 0;
+  const WorkQueue *last_queue_ = nullptr;
+
+  State state_;
+  std::vector<Action> actions_;
+  size_t steps_ = 0;
+};
+
+// An experiment that ThreadPool::run() explores with one set per worker,
+// built by `set` and kept for all of that worker's paths, so that each path
+// resumes from the worker's checkpoints.  `check` sees the state at the end
+// of each path.  A bad path is the first path of
+// WorkQueue(std::move(bad_path)) for a new set; replay() does not apply.
+template<std::copyable State, CheckpointableAction<State> Action>
+std::shared_ptr<ExperimentBuilder<CheckpointedActionSet<State, Action>>>
+checkpointed_experiment(
+    std::function<CheckpointedActionSet<State, Action>()> set,
+    std::function<bool(ActionResult, State &)> check)
+{
+  using Set = CheckpointedActionSet<State, Action>;
+  auto experiment = std::make_shared<ExperimentBuilder<Set>>(
+      [set = std::move(set)]() { return std::make_tuple(set()); },
+      [](WorkQueue &work_queue, Set &set) { return set.run(work_queue); },
+      [check = std::move(check)](ActionResult res, Set &set) {
+        return check(res, set.state());
+      });
+  // run() starts each path from a checkpoint by itself.
+  experiment->set_reset([](Set & /*set*/) {});
+  return experiment;
+}
+
+} // namespace model
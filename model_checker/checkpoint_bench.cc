@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/checkpoint.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+namespace {
+
+struct Counter {
+  int steps;
+
+  bool step(int &value)
+  {
+    value++;
+    return --steps > 0;
+  }
+};
+
+// Two actions of `steps` steps each, replayed from the start on every path.
+void
+BM_ReplayFromStart(benchmark::State &state)
+{
+  const auto steps = static_cast<int>(state.range(0));
+  size_t paths = 0;
+  for (auto _ : state) {
+    WorkQueue work_queue;
+    while (!work_queue.done()) {
+      RunnableActionSet set(work_queue);
+      int value = 0;
+      for (int i = 0; i < 2; i++) {
+        set.add_action(
+            [](RunnableActionSet &set, int &value, int steps) -> Async {
+              for (int j = 0; j < steps; j++) {
+                co_await set.bg();
+                value++;
+              }
+            },
+            value, int{steps});
+      }
+      benchmark::DoNotOptimize(set.run());
+      work_queue.advance_cursor();
+      paths++;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+}
+BENCHMARK(BM_ReplayFromStart)->Arg(10);
+
+// The same tree, resumed from checkpoints.
+void
+BM_ReplayFromCheckpoint(benchmark::State &state)
+{
+  const auto steps = static_cast<int>(state.range(0));
+  size_t paths = 0;
+  for (auto _ : state) {
+    WorkQueue work_queue;
+    CheckpointedActionSet<int, Counter> set(
+        0, {Counter{.steps = steps}, Counter{.steps = steps}});
+    while (!work_queue.done()) {
+      benchmark::DoNotOptimize(set.run(work_queue));
+      work_queue.advance_cursor();
+      paths++;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+}
+BENCHMARK(BM_ReplayFromCheckpoint)->Arg(10);
+
+} // namespace
+} // namespace model
@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/checkpoint.h"
+#include "model_checker/progress.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+namespace {
+
+// Appends its id to the trace, `steps` times.
+struct Appender {
+  int id;
+  int steps;
+
+  bool step(std::vector<int> &trace)
+  {
+    trace.push_back(id);
+    return --steps > 0;
+  }
+};
+
+std::vector<Appender>
+appenders()
+{
+  return {Appender{.id = 0, .steps = 2}, Appender{.id = 1, .steps = 2},
+          Appender{.id = 2, .steps = 1}};
+}
+
+using AppenderSet = CheckpointedActionSet<std::vector<int>, Appender>;
+
+} // namespace
+
+TEST(Checkpoint, ExploresEveryInterleaving)
+{
+  WorkQueue work_queue;
+  CheckpointedActionSet<std::vector<int>, Appender> set({}, appenders());
+  std::set<std::vector<int>> traces;
+  size_t paths = 0;
+  while (!work_queue.done()) {
+    ASSERT_EQ(set.run(work_queue), ActionResult::kOk);
+    traces.insert(set.state());
+    paths++;
+    work_queue.advance_cursor();
+  }
+  // 5! / (2! * 2!)
+  EXPECT_EQ(paths, 30);
+  EXPECT_EQ(traces.size(), 30);
+  // Each step of the tree runs once: there are 89 distinct nonempty prefixes
+  // of the 30 traces.  Replaying every path from the start would take 150.
+  EXPECT_EQ(set.steps(), 89);
+}
+
+TEST(Checkpoint, MatchesRunnableActionSet)
+{
+  std::vector<std::vector<uint8_t>> expected;
+  {
+    WorkQueue work_queue;
+    while (!work_queue.done()) {
+      RunnableActionSet set(work_queue);
+      std::vector<int> trace;
+      for (auto appender : appenders()) {
+        set.add_action(
+            [](RunnableActionSet &set, std::vector<int> &trace,
+               Appender appender) -> Async {
+              do {
+                co_await set.bg();
+              } while (appender.step(trace));
+            },
+            trace, std::move(appender));
+      }
+      ASSERT_EQ(set.run(), ActionResult::kOk);
+      expected.push_back(work_queue.get_current_path());
+      work_queue.advance_cursor();
+    }
+  }
+
+  WorkQueue work_queue;
+  CheckpointedActionSet<std::vector<int>, Appender> set({}, appenders(), 2);
+  std::vector<std::vector<uint8_t>> paths;
+  while (!work_queue.done()) {
+    ASSERT_EQ(set.run(work_queue), ActionResult::kOk);
+    paths.push_back(work_queue.get_current_path());
+    work_queue.advance_cursor();
+  }
+  EXPECT_EQ(paths, expected);
+}
+
+TEST(Checkpoint, StolenWork)
+{
+  WorkQueue work_queue;
+  CheckpointedActionSet<std::vector<int>, Appender> set({}, appenders());
+  std::set<std::vector<int>> traces;
+  ASSERT_EQ(set.run(work_queue), ActionResult::kOk);
+  traces.insert(set.state());
+  work_queue.advance_cursor();
+
+  // The same set runs the stolen queue, whose paths share nothing with the
+  // checkpoints of the first one.
+  auto stolen = work_queue.steal_work();
+  ASSERT_TRUE(stolen);
+  for (auto *queue : {&work_queue, stolen.get()}) {
+    while (!queue->done()) {
+      ASSERT_EQ(set.run(*queue), ActionResult::kOk);
+      EXPECT_TRUE(traces.insert(set.state()).second);
+      queue->advance_cursor();
+    }
+  }
+  EXPECT_EQ(traces.size(), 30);
+}
+
+TEST(Checkpoint, PathWeights)
+{
+  // Paths that resume from a checkpoint still stand for their own share of
+  // the tree, as they would if every choice were made again.
+  WorkQueue work_queue;
+  CheckpointedActionSet<std::vector<int>, Appender> set({}, appenders(), 2);
+  double total = 0;
+  while (!work_queue.done()) {
+    ASSERT_EQ(set.run(work_queue), ActionResult::kOk);
+    EXPECT_LT(work_queue.path_weight(), 1);
+    total += work_queue.path_weight();
+    work_queue.advance_cursor();
+  }
+  EXPECT_DOUBLE_EQ(total, 1);
+}
+
+TEST(Checkpoint, DecisionLimit)
+{
+  WorkQueue work_queue;
+  CheckpointedActionSet<std::vector<int>, Appender> set({}, appenders(), 1, 3);
+  EXPECT_EQ(set.run(work_queue), ActionResult::kTimeout);
+  EXPECT_EQ(set.state().size(), 3);
+}
+
+TEST(Checkpoint, ThreadPool)
+{
+  auto experiment = checkpointed_experiment<std::vector<int>, Appender>(
+      [] { return AppenderSet({}, appenders()); },
+      [](ActionResult res, std::vector<int> &trace) {
+        return res == ActionResult::kOk && trace.size() == 5;
+      });
+  ThreadPool<AppenderSet> pool(4);
+  EXPECT_TRUE(pool.run_test(experiment));
+  EXPECT_EQ(pool.paths(), 30);
+
+  // Only fails on the paths that start with action 2 and then action 1.
+  auto bad = checkpointed_experiment<std::vector<int>, Appender>(
+      [] { return AppenderSet({}, appenders()); },
+      [](ActionResult res, std::vector<int> &trace) {
+        return res == ActionResult::kOk && trace[0] * 10 + trace[1] != 21;
+      });
+  // Progress counts each path for its own share of the tree.
+  std::vector<Progress> reports;
+  pool.set_progress_callback(
+      [&reports](const Progress &progress) { reports.push_back(progress); },
+      std::chrono::milliseconds(1));
+  auto slow = checkpointed_experiment<std::vector<int>, Appender>(
+      [] { return AppenderSet({}, appenders()); },
+      [](ActionResult res, std::vector<int> & /*trace*/) {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        return res == ActionResult::kOk;
+      });
+  EXPECT_TRUE(pool.run_test(slow));
+  pool.set_progress_callback(nullptr);
+  ASSERT_GE(reports.size(), 2);
+  for (const auto &report : reports) {
+    if (report.paths < 30) {
+      EXPECT_LT(report.done, 1);
+    }
+  }
+  EXPECT_LT(reports.front().paths, 30);
+  EXPECT_DOUBLE_EQ(reports.back().done, 1);
+  EXPECT_DOUBLE_EQ(reports.back().estimated_paths, 30);
+
+  auto bad_path = pool.run(bad);
+  ASSERT_TRUE(bad_path);
+  WorkQueue work_queue(std::move(*bad_path));
+  AppenderSet set({}, appenders());
+  ASSERT_EQ(set.run(work_queue), ActionResult::kOk);
+  EXPECT_EQ(set.state()[0], 2);
+  EXPECT_EQ(set.state()[1], 1);
+}
+
+} // namespace model
@@ -0,0 +1,47 @@
+#include "model_checker/counting_alloc.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Thread-local, so that counting does not make threads contend.
+thread_local size_t allocation_count = 0;
+
+} // namespace
+
+// These are kept out of line: once GCC inlines them into each other's
+// callers, it sees malloc() paired with delete, or new with free(), and
+// warns (-Wmismatched-new-delete), although they do match.
+[[gnu::noinline]] void *
+operator new(size_t size)
+{
+  allocation_count++;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void
+operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+[[gnu::noinline]] void
+operator delete(void *p, size_t /*size*/) noexcept
+{
+  std::free(p);
+}
+
+namespace model {
+
+size_t
+allocations()
+{
+  return allocation_count;
+}
+
+} // namespace model
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+namespace model {
+
+// The heap allocations that the calling thread has made so far.  Only
+// binaries that link counting_alloc.cc, which replaces the global operator
+// new and delete, have this; the library does not.
+size_t allocations();
+
+} // namespace model
@@ -0,0 +1,705 @@
+#include "model_checker/distributed.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "model_checker/frontier.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+namespace {
+
+// Every message starts with one of these (see kHeaderSize).
+enum class Message : uint8_t {
+  // Worker to coordinator: the paths checked since the last request (u64).
+  // The worker has finished everything that it was handed.
+  kRequest = 1,
+  // Worker to coordinator, in answer to kSteal: the frontier that it gives
+  // back, then the one that it keeps.  Both are empty if it had nothing in
+  // progress.
+  kDonation = 2,
+  // Worker to coordinator: the paths checked (u64), and a bad path (u64
+  // length, then the choices).
+  kBadPath = 3,
+  // Coordinator to worker: a frontier to explore.
+  kWork = 4,
+  // Coordinator to worker: give back half of your work.
+  kSteal = 5,
+  // Coordinator to worker: the search is over.
+  kStop = 6,
+};
+
+// Every message is its type, the length of the rest of it (u64), and then
+// the rest, so that a reader knows how much to wait for before it decodes
+// anything.
+constexpr size_t kHeaderSize = sizeof(Message) + sizeof(uint64_t);
+
+bool
+write_all(int fd, const void *data, size_t size)
+{
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    // No SIGPIPE if the other end is gone.
+    ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Returns false on end of file.
+bool
+read_all(int fd, void *data, size_t size)
+{
+  auto *bytes = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    ssize_t got = ::read(fd, bytes, size);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    bytes += got;
+    size -= got;
+  }
+  return true;
+}
+
+template<typename T>
+bool
+read_value(int fd, T &value)
+{
+  return read_all(fd, &value, sizeof(value));
+}
+
+// Reads the rest of a message, `length` bytes, into `body`.  The length is
+// only trusted as far as bytes arrive, so the buffer grows as they do.
+bool
+read_body(int fd, std::vector<uint8_t> &body, uint64_t length)
+{
+  constexpr size_t kChunk = 64 * 1024;
+  body.clear();
+  while (body.size() < length) {
+    size_t old_size = body.size();
+    size_t size = std::min<uint64_t>(length - old_size, kChunk);
+    body.resize(old_size + size);
+    if (!read_all(fd, body.data() + old_size, size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename T>
+void
+append(std::vector<uint8_t> &message, const T &value)
+{
+  size_t at = message.size();
+  message.resize(at + sizeof(value));
+  std::memcpy(message.data() + at, &value, sizeof(value));
+}
+
+// A message with its header, and the length to be filled in by seal() once
+// the rest is appended.
+std::vector<uint8_t>
+start_message(Message type)
+{
+  std::vector<uint8_t> message{static_cast<uint8_t>(type)};
+  append(message, uint64_t{0});
+  return message;
+}
+
+std::vector<uint8_t>
+seal(std::vector<uint8_t> message)
+{
+  uint64_t length = message.size() - kHeaderSize;
+  std::memcpy(message.data() + sizeof(Message), &length, sizeof(length));
+  return message;
+}
+
+void
+append_frontier(std::vector<uint8_t> &message, const Frontier &frontier)
+{
+  auto encoded = encode_frontier(frontier);
+  message.insert(message.end(), encoded.begin(), encoded.end());
+}
+
+// Reads a frontier out of the rest of a message.
+std::optional<Frontier>
+frontier_from(std::span<const uint8_t> bytes)
+{
+  size_t used = 0;
+  return decode_frontier(
+      [&](void *data, size_t size) {
+        std::memcpy(data, bytes.data() + used, size);
+        used += size;
+        return true;
+      },
+      bytes.size());
+}
+
+[[noreturn]] void
+throw_errno(const char *what)
+{
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Opens a socket for `address` (a Unix domain socket path, or host:port),
+// listening on it or connected to it.
+int
+open_socket(const std::string &address, bool listening)
+{
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos || address.starts_with('/')) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(addr.sun_path)) {
+      errno = ENAMETOOLONG;
+      throw_errno("socket path");
+    }
+    std::memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw_errno("socket");
+    }
+    if (listening) {
+      ::unlink(address.c_str());
+    }
+    auto *sa = reinterpret_cast<sockaddr *>(&addr);
+    if ((listening ? ::bind(fd, sa, sizeof(addr))
+                   : ::connect(fd, sa, sizeof(addr))) != 0 ||
+        (listening && ::listen(fd, SOMAXCONN) != 0)) {
+      int err = errno;
+      ::close(fd);
+      errno = err;
+      throw_errno(listening ? "bind" : "connect");
+    }
+    return fd;
+  }
+
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  addrinfo *found = nullptr;
+  if (int err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                              port.c_str(), &hints, &found);
+      err != 0) {
+    throw std::system_error(EINVAL, std::generic_category(),
+                            ::gai_strerror(err));
+  }
+  std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> addrs(found,
+                                                             ::freeaddrinfo);
+  for (addrinfo *ai = addrs.get(); ai != nullptr; ai = ai->ai_next) {
+    int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                      ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (listening) {
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+          ::listen(fd, SOMAXCONN) == 0) {
+        return fd;
+      }
+    }
+    else if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      return fd;
+    }
+    int err = errno;
+    ::close(fd);
+    errno = err;
+  }
+  throw_errno(listening ? "bind" : "connect");
+}
+
+} // namespace
+
+struct Coordinator::Worker {
+  enum class State {
+    // Connected, but has not asked for work yet.
+    kNew,
+    kIdle,
+    kBusy,
+  };
+
+  int fd = -1;
+  State state = State::kNew;
+  // What the worker holds, to hand out again if it disconnects: what it was
+  // last handed, or what it kept when it last gave work back.
+  std::vector<WorkQueue::Prefix> assigned{};
+  // What the worker sent that is not a whole message yet.
+  std::vector<uint8_t> received{};
+  bool steal_pending = false;
+  std::chrono::steady_clock::time_point steal_after{};
+};
+
+// Reads the rest of a message, all of which has been received.
+class Coordinator::Reader {
+public:
+  explicit Reader(std::span<const uint8_t> bytes) : bytes_(bytes) {}
+
+  // Fails if the message does not have `size` more bytes.
+  bool read(void *data, size_t size)
+  {
+    if (size > remaining()) {
+      return false;
+    }
+    std::memcpy(data, bytes_.data() + used_, size);
+    used_ += size;
+    return true;
+  }
+
+  template<typename T> bool read_value(T &value)
+  {
+    return read(&value, sizeof(value));
+  }
+
+  bool read_bytes(std::vector<uint8_t> &out, uint64_t size)
+  {
+    // Checked before allocating, since `size` comes off the wire.
+    if (size > remaining()) {
+      return false;
+    }
+    out.resize(size);
+    return read(out.data(), out.size());
+  }
+
+  std::optional<Frontier> read_frontier()
+  {
+    // Likewise for the lengths inside the frontier.
+    return decode_frontier(
+        [this](void *data, size_t size) { return read(data, size); },
+        remaining());
+  }
+
+  size_t remaining() const { return bytes_.size() - used_; }
+
+private:
+  std::span<const uint8_t> bytes_;
+  size_t used_ = 0;
+};
+
+Coordinator::Coordinator(const std::string &address,
+                         CoordinatorOptions options)
+  : options_(options), listen_fd_(open_socket(address, true))
+{
+  options_.batch_size = std::max<size_t>(options_.batch_size, 1);
+  if (address.find(':') == std::string::npos || address.starts_with('/')) {
+    unix_path_ = address;
+  }
+}
+
+Coordinator::~Coordinator()
+{
+  for (auto &worker : workers_) {
+    ::close(worker->fd);
+  }
+  ::close(listen_fd_);
+  if (!unix_path_.empty()) {
+    ::unlink(unix_path_.c_str());
+  }
+}
+
+std::optional<std::vector<uint8_t>>
+Coordinator::run(const SearchOptions &options,
+                 std::vector<uint8_t> initial_path)
+{
+  search_options_ = options;
+  paths_ = 0;
+  steals_ = 0;
+  bad_path_ = std::nullopt;
+  pending_.clear();
+  WorkQueue::Prefix root{.choices = std::move(initial_path)};
+  if (options.partial_order_reduction) {
+    // As in WorkQueue: none of the alternatives on the way are ours.
+    root.scheduled.assign(root.choices.size(), ~uint32_t{0});
+    root.explored.assign(root.choices.size(), 0);
+  }
+  pending_.push_back(std::move(root));
+
+  while (!bad_path_) {
+    hand_out_work();
+    bool busy = std::ranges::any_of(workers_, [](const auto &worker) {
+      return worker->state == Worker::State::kBusy;
+    });
+    if (!busy && pending_.empty()) {
+      break;
+    }
+
+    std::vector<pollfd> fds{{.fd = listen_fd_, .events = POLLIN, .revents = 0}};
+    for (const auto &worker : workers_) {
+      fds.push_back({.fd = worker->fd, .events = POLLIN, .revents = 0});
+    }
+    // Wakes up to retry workers that had nothing to give back.
+    auto now = std::chrono::steady_clock::now();
+    int timeout = -1;
+    if (std::ranges::any_of(workers_, [now](const auto &worker) {
+          return worker->steal_after > now;
+        })) {
+      timeout = static_cast<int>(options_.steal_backoff.count());
+    }
+    if (::poll(fds.data(), fds.size(), timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_errno("poll");
+    }
+
+    // Workers that disconnect are dropped from the back, so that the indices
+    // into fds stay valid.
+    for (size_t i = workers_.size(); i-- > 0;) {
+      if (fds[i + 1].revents != 0 && !receive(*workers_[i])) {
+        drop_worker(*workers_[i]);
+        workers_.erase(workers_.begin() + static_cast<ptrdiff_t>(i));
+      }
+    }
+    if ((fds[0].revents & POLLIN) != 0) {
+      accept_worker();
+    }
+  }
+
+  for (auto &worker : workers_) {
+    auto stop = seal(start_message(Message::kStop));
+    write_all(worker->fd, stop.data(), stop.size());
+    ::close(worker->fd);
+  }
+  workers_.clear();
+  pending_.clear();
+  return bad_path_;
+}
+
+void
+Coordinator::accept_worker()
+{
+  int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  workers_.push_back(std::make_unique<Worker>(Worker{.fd = fd}));
+}
+
+bool
+Coordinator::receive(Worker &worker)
+{
+  // poll() said there is something to read, but maybe not all of it.
+  constexpr size_t kChunk = 64 * 1024;
+  auto &received = worker.received;
+  size_t old_size = received.size();
+  received.resize(old_size + kChunk);
+  ssize_t got =
+      ::recv(worker.fd, received.data() + old_size, kChunk, MSG_DONTWAIT);
+  received.resize(old_size + std::max<ssize_t>(got, 0));
+  if (got < 0) {
+    return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  if (got == 0) {
+    return false;
+  }
+
+  // Only the headers are looked at until a message is all there, so each
+  // message is decoded once however many chunks it came in.
+  size_t used = 0;
+  while (received.size() - used >= kHeaderSize) {
+    uint8_t type = received[used];
+    uint64_t length = 0;
+    std::memcpy(&length, received.data() + used + sizeof(type),
+                sizeof(length));
+    if (length > received.size() - used - kHeaderSize) {
+      break;
+    }
+    Reader reader(
+        std::span<const uint8_t>(received).subspan(used + kHeaderSize, length));
+    if (!handle_message(worker, type, reader)) {
+      return false;
+    }
+    used += kHeaderSize + length;
+  }
+  received.erase(received.begin(),
+                 received.begin() + static_cast<ptrdiff_t>(used));
+  return true;
+}
+
+bool
+Coordinator::handle_message(Worker &worker, uint8_t type, Reader &reader)
+{
+  // Nothing changes until the whole message has been read.
+  switch (static_cast<Message>(type)) {
+  case Message::kRequest: {
+    uint64_t paths = 0;
+    if (!reader.read_value(paths)) {
+      return false;
+    }
+    paths_ += paths;
+    worker.state = Worker::State::kIdle;
+    worker.assigned.clear();
+    return true;
+  }
+  case Message::kDonation: {
+    auto given = reader.read_frontier();
+    if (!given) {
+      return false;
+    }
+    auto kept = reader.read_frontier();
+    if (!kept) {
+      return false;
+    }
+    worker.steal_pending = false;
+    if (!kept->prefixes.empty()) {
+      // The worker went on with only these.
+      worker.assigned = std::move(kept->prefixes);
+    }
+    if (given->prefixes.empty()) {
+      worker.steal_after =
+          std::chrono::steady_clock::now() + options_.steal_backoff;
+      return true;
+    }
+    steals_++;
+    std::ranges::move(given->prefixes, std::back_inserter(pending_));
+    return true;
+  }
+  case Message::kBadPath: {
+    uint64_t paths = 0;
+    uint64_t length = 0;
+    std::vector<uint8_t> path;
+    if (!reader.read_value(paths) || !reader.read_value(length) ||
+        !reader.read_bytes(path, length)) {
+      return false;
+    }
+    paths_ += paths;
+    worker.state = Worker::State::kIdle;
+    worker.assigned.clear();
+    if (!bad_path_) {
+      bad_path_ = std::move(path);
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+void
+Coordinator::hand_out_work()
+{
+  size_t idle = 0;
+  for (auto &worker : workers_) {
+    if (worker->state != Worker::State::kIdle) {
+      continue;
+    }
+    if (pending_.empty()) {
+      idle++;
+      continue;
+    }
+    // The oldest prefixes first, which tend to be the shallowest.
+    size_t n = std::min(options_.batch_size, pending_.size());
+    Frontier batch{.options = search_options_,
+                   .prefixes = {std::make_move_iterator(pending_.begin()),
+                                std::make_move_iterator(pending_.begin() + n)}};
+    pending_.erase(pending_.begin(), pending_.begin() + n);
+    // If the worker is gone, handle_message() finds out.
+    auto message = start_message(Message::kWork);
+    append_frontier(message, batch);
+    message = seal(std::move(message));
+    write_all(worker->fd, message.data(), message.size());
+    worker->assigned = std::move(batch.prefixes);
+    worker->state = Worker::State::kBusy;
+  }
+
+  // One steal request per idle worker, spread over the busy ones.
+  size_t pending_steals = std::ranges::count_if(
+      workers_, [](const auto &worker) { return worker->steal_pending; });
+  auto now = std::chrono::steady_clock::now();
+  for (auto &worker : workers_) {
+    if (pending_steals >= idle) {
+      break;
+    }
+    if (worker->state == Worker::State::kBusy && !worker->steal_pending &&
+        worker->steal_after <= now) {
+      auto steal = seal(start_message(Message::kSteal));
+      write_all(worker->fd, steal.data(), steal.size());
+      worker->steal_pending = true;
+      pending_steals++;
+    }
+  }
+}
+
+void
+Coordinator::drop_worker(Worker &worker)
+{
+  if (worker.state == Worker::State::kBusy) {
+    std::ranges::move(worker.assigned, std::back_inserter(pending_));
+  }
+  ::close(worker.fd);
+}
+
+CoordinatorConnection::CoordinatorConnection(
+    const std::string &address,
+    std::function<std::optional<Frontier>()> interrupt)
+  : fd_(open_socket(address, false)), interrupt_(std::move(interrupt)),
+    listener_([this] { listen(); })
+{}
+
+CoordinatorConnection::~CoordinatorConnection()
+{
+  // Wakes up the listener.
+  ::shutdown(fd_, SHUT_RDWR);
+  listener_.join();
+  ::close(fd_);
+}
+
+std::optional<Frontier>
+CoordinatorConnection::request_work(size_t paths)
+{
+  {
+    std::lock_guard lock(mtx_);
+    work_ = std::nullopt;
+  }
+  auto message = start_message(Message::kRequest);
+  append(message, uint64_t{paths});
+  send(seal(std::move(message)));
+
+  std::unique_lock lock(mtx_);
+  cv_.wait(lock, [this] { return work_ || stopped_; });
+  if (stopped_) {
+    return std::nullopt;
+  }
+  return std::move(work_);
+}
+
+std::optional<Frontier>
+CoordinatorConnection::rest_after_interrupt()
+{
+  std::unique_lock lock(mtx_);
+  cv_.wait(lock, [this] { return rest_ || stopped_; });
+  if (stopped_) {
+    return std::nullopt;
+  }
+  auto rest = std::move(rest_);
+  rest_ = std::nullopt;
+  return rest;
+}
+
+void
+CoordinatorConnection::report_bad_path(size_t paths,
+                                       const std::vector<uint8_t> &path)
+{
+  auto message = start_message(Message::kBadPath);
+  append(message, uint64_t{paths});
+  append(message, uint64_t{path.size()});
+  message.insert(message.end(), path.begin(), path.end());
+  send(seal(std::move(message)));
+}
+
+void
+CoordinatorConnection::listen()
+{
+  Message type{};
+  uint64_t length = 0;
+  std::vector<uint8_t> body;
+  while (read_value(fd_, type) && read_value(fd_, length) &&
+         read_body(fd_, body, length)) {
+    if (type == Message::kWork) {
+      auto frontier = frontier_from(body);
+      if (!frontier) {
+        break;
+      }
+      std::lock_guard lock(mtx_);
+      work_ = std::move(frontier);
+      cv_.notify_all();
+    }
+    else if (type == Message::kSteal) {
+      give_back_work();
+    }
+    else {
+      break;
+    }
+  }
+  // kStop, or the coordinator is gone.
+  {
+    std::lock_guard lock(mtx_);
+    stopped_ = true;
+    cv_.notify_all();
+  }
+  interrupt_();
+}
+
+void
+CoordinatorConnection::give_back_work()
+{
+  auto frontier = interrupt_();
+  if (!frontier) {
+    // Nothing in progress: the worker is between batches.
+    auto message = start_message(Message::kDonation);
+    append_frontier(message, {});
+    append_frontier(message, {});
+    send(seal(std::move(message)));
+    return;
+  }
+
+  // Alternate, from the shallowest prefix down, so that both halves get a
+  // share of the big subtrees.
+  auto &prefixes = frontier->prefixes;
+  std::ranges::stable_sort(prefixes, {}, [](const WorkQueue::Prefix &prefix) {
+    return prefix.choices.size();
+  });
+  Frontier given{.options = frontier->options, .prefixes = {}};
+  Frontier kept{.options = frontier->options, .prefixes = {}};
+  for (size_t i = 0; i < prefixes.size(); i++) {
+    (i % 2 == 0 ? kept : given).prefixes.push_back(std::move(prefixes[i]));
+  }
+  auto message = start_message(Message::kDonation);
+  append_frontier(message, given);
+  append_frontier(message, kept);
+  send(seal(std::move(message)));
+
+  std::lock_guard lock(mtx_);
+  rest_ = std::move(kept);
+  cv_.notify_all();
+}
+
+void
+CoordinatorConnection::send(const std::vector<uint8_t> &message)
+{
+  std::lock_guard lock(write_mtx_);
+  // If the coordinator is gone, the listener finds out.
+  write_all(fd_, message.data(), message.size());
+}
+
+} // namespace model
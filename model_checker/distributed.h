@@ -0,0 +1,167 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model_checker/frontier.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+struct CoordinatorOptions {
+  // The most subtrees handed to a worker per request, so that a worker that
+  // ran out of work gets plenty in one round trip.
+  size_t batch_size = 16;
+  // How long to leave a worker alone after it had nothing to give back.
+  std::chrono::milliseconds steal_backoff{10};
+};
+
+// Hands out the subtrees of a search to worker processes, which connect with
+// run_distributed_worker(), on this machine or others.  Each worker explores
+// what it gets with a ThreadPool of its own.  Once the coordinator has no
+// subtrees left and some worker is idle, it asks busy workers to give back
+// half of their work, one request per busy worker however many are idle, and
+// hands that out in batches.
+//
+// The coordinator reads from all workers at once, and only handles a
+// message once all of it is there, so a slow worker does not hold up the
+// others.  If a worker disconnects before it finishes, the subtrees that it
+// still holds (what it was last handed, less what it gave back since) go to
+// other workers.  The paths that it checked there are checked again, but
+// were never reported.  Frontiers go over the wire in native byte order, so
+// every host has to share one.
+class Coordinator {
+public:
+  // Listens on `address`: a path for a Unix domain socket, or host:port for
+  // TCP.  Throws std::system_error if it cannot.
+  explicit Coordinator(const std::string &address,
+                       CoordinatorOptions options = {});
+  ~Coordinator();
+
+  // disable copy and move
+  Coordinator(const Coordinator &) = delete;
+  Coordinator &operator=(const Coordinator &) = delete;
+  Coordinator(Coordinator &&) = delete;
+  Coordinator &operator=(Coordinator &&) = delete;
+
+  // Serves workers until every subtree below `initial_path` is explored, or
+  // some worker finds a bad path, which it returns.  Workers are told to
+  // stop before it returns.
+  [[nodiscard]]
+  std::optional<std::vector<uint8_t>>
+  run(const SearchOptions &options, std::vector<uint8_t> initial_path = {});
+
+  // The number of paths that the workers of the last run() checked.
+  size_t paths() const { return paths_; }
+  // The number of times that the last run() took work back from a worker.
+  size_t steals() const { return steals_; }
+
+private:
+  struct Worker;
+  class Reader;
+
+  void accept_worker();
+  // Reads what the worker sent, and handles the messages that are complete.
+  // Returns false if the worker disconnected or sent a malformed message.
+  bool receive(Worker &worker);
+  // Handles a message of type `type`, the rest of which is in `reader`.
+  // Returns false if it is malformed.
+  bool handle_message(Worker &worker, uint8_t type, Reader &reader);
+  void hand_out_work();
+  void drop_worker(Worker &worker);
+
+  CoordinatorOptions options_;
+  int listen_fd_ = -1;
+  std::string unix_path_;
+  SearchOptions search_options_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<WorkQueue::Prefix> pending_;
+  std::optional<std::vector<uint8_t>> bad_path_;
+  size_t paths_ = 0;
+  size_t steals_ = 0;
+};
+
+// A worker's end of the connection to a Coordinator.  A thread of its own
+// reads what the coordinator sends.  When the coordinator wants work back,
+// that thread calls `interrupt`, which stops the exploration in progress and
+// returns its frontier (as ThreadPool::interrupt() does), gives half of it
+// to the coordinator, and keeps the rest for rest_after_interrupt().  It
+// tells the coordinator which half it kept, too.
+class CoordinatorConnection {
+public:
+  // Throws std::system_error if it cannot connect.
+  CoordinatorConnection(const std::string &address,
+                        std::function<std::optional<Frontier>()> interrupt);
+  ~CoordinatorConnection();
+
+  // disable copy and move
+  CoordinatorConnection(const CoordinatorConnection &) = delete;
+  CoordinatorConnection &operator=(const CoordinatorConnection &) = delete;
+  CoordinatorConnection(CoordinatorConnection &&) = delete;
+  CoordinatorConnection &operator=(CoordinatorConnection &&) = delete;
+
+  // Reports the paths checked since the last request, and waits for more
+  // work.  Returns nullopt once the coordinator is done.
+  std::optional<Frontier> request_work(size_t paths);
+  // After `interrupt` stopped an exploration for the coordinator, waits for
+  // the part of its frontier that this worker keeps.  Returns nullopt if
+  // the coordinator is done.
+  std::optional<Frontier> rest_after_interrupt();
+  void report_bad_path(size_t paths, const std::vector<uint8_t> &path);
+
+private:
+  void listen();
+  void give_back_work();
+  void send(const std::vector<uint8_t> &message);
+
+  int fd_ = -1;
+  std::function<std::optional<Frontier>()> interrupt_;
+  std::mutex write_mtx_;
+  // mtx_ protects what the listener hands to the worker.
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::optional<Frontier> work_;
+  std::optional<Frontier> rest_;
+  bool stopped_ = false;
+  std::jthread listener_;
+};
+
+// Explores the subtrees that the coordinator at `address` hands out with
+// `pool`, until the coordinator is done.  `pool` must not checkpoint, since
+// it is interrupted whenever the coordinator wants work back.
+template<typename... Args>
+void
+run_distributed_worker(const std::string &address, ThreadPool<Args...> &pool,
+                       std::shared_ptr<ExperimentBuilder<Args...>> experiment)
+{
+  CoordinatorConnection connection(address,
+                                   [&pool] { return pool.interrupt(); });
+  size_t paths = 0;
+  auto work = connection.request_work(paths);
+  while (work) {
+    auto bad_path = pool.resume(experiment, std::move(*work));
+    paths += pool.paths();
+    if (bad_path) {
+      connection.report_bad_path(paths, *bad_path);
+      return;
+    }
+    if (pool.interrupted()) {
+      work = connection.rest_after_interrupt();
+      continue;
+    }
+    work = connection.request_work(paths);
+    paths = 0;
+  }
+}
+
+} // namespace model
@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/distributed.h"
+#include "model_checker/frontier.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+namespace {
+
+// Four actions of two steps each: 8! / 2^4 = 2520 paths.  Fails on the path
+// where action 3 runs both of its steps first, if `fail` is set.
+std::shared_ptr<ExperimentBuilder<int, int>>
+distributed_experiment(bool fail)
+{
+  return std::make_shared<ExperimentBuilder<int, int>>(
+      []() { return std::make_tuple(0, 0); },
+      [](WorkQueue &work_queue, int &a, int &b) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 4; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &a, int &b, int i) -> Async {
+                co_await set.bg();
+                a = a * 10 + i;
+                co_await set.bg();
+                b = b * 10 + i;
+              },
+              a, b, int{i});
+        }
+        return actions;
+      },
+      [fail](ActionResult res, int &a, int & /*b*/) -> bool {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        return res == ActionResult::kOk && !(fail && a / 1000 == 3);
+      });
+}
+
+// Forks `n` worker processes, with `threads` threads each, that serve the
+// coordinator at `address`, once `ready` (if any) has something to read.
+std::vector<pid_t>
+start_workers(size_t n, const std::string &address, bool fail, int ready = -1,
+              size_t threads = 1)
+{
+  std::vector<pid_t> pids;
+  for (size_t i = 0; i < n; i++) {
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      char byte = 0;
+      if (ready >= 0 && ::read(ready, &byte, 1) != 1) {
+        ::_exit(1);
+      }
+      ThreadPool<int, int> pool(threads);
+      run_distributed_worker(address, pool, distributed_experiment(fail));
+      ::_exit(0);
+    }
+    pids.push_back(pid);
+  }
+  return pids;
+}
+
+void
+wait_for_workers(const std::vector<pid_t> &pids)
+{
+  for (pid_t pid : pids) {
+    int status = 0;
+    ASSERT_EQ(::waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+  }
+}
+
+} // namespace
+
+TEST(Distributed, WorkersCoverEveryPath)
+{
+  std::string address = ::testing::TempDir() + "coordinator_every_path";
+  Coordinator coordinator(address, {.batch_size = 4});
+  auto pids = start_workers(3, address, false);
+  EXPECT_FALSE(coordinator.run({}));
+  wait_for_workers(pids);
+
+  EXPECT_EQ(coordinator.paths(), 2520);
+  EXPECT_GT(coordinator.steals(), 0);
+}
+
+TEST(Distributed, MultiThreadedWorkersCountExactly)
+{
+  ThreadPool<int, int> single(1);
+  EXPECT_FALSE(single.run(distributed_experiment(false)));
+
+  std::string address = ::testing::TempDir() + "coordinator_threads";
+  Coordinator coordinator(address, {.batch_size = 2});
+  // Small batches, so that the workers are interrupted to give work back
+  // while their threads steal from each other.
+  auto pids = start_workers(3, address, false, -1, 4);
+  EXPECT_FALSE(coordinator.run({}));
+  wait_for_workers(pids);
+
+  EXPECT_EQ(coordinator.paths(), single.paths());
+  EXPECT_GT(coordinator.steals(), 0);
+}
+
+TEST(Distributed, PartialMessageDoesNotBlockOthers)
+{
+  std::string address = ::testing::TempDir() + "coordinator_partial";
+  Coordinator coordinator(address);
+  // Sends the first byte of a request, and never the rest.
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+  ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)),
+            0);
+  uint8_t request = 1;
+  ASSERT_EQ(::write(fd, &request, 1), 1);
+
+  auto pids = start_workers(2, address, false);
+  EXPECT_FALSE(coordinator.run({}));
+  wait_for_workers(pids);
+  EXPECT_EQ(coordinator.paths(), 2520);
+  ::close(fd);
+}
+
+TEST(Distributed, DisconnectAfterGivingWorkBack)
+{
+  std::string address = ::testing::TempDir() + "coordinator_disconnect";
+  Coordinator coordinator(address);
+  int ready[2];
+  ASSERT_EQ(::pipe(ready), 0);
+
+  // Takes the whole tree, gives back half of the subtrees below the first
+  // decision when asked, and then leaves without checking the other half.
+  pid_t quitter = ::fork();
+  if (quitter == 0) {
+    bool interrupted = false;
+    CoordinatorConnection connection(
+        address, [&interrupted]() -> std::optional<Frontier> {
+          if (std::exchange(interrupted, true)) {
+            return std::nullopt;
+          }
+          Frontier frontier;
+          for (uint8_t i = 0; i < 4; i++) {
+            frontier.prefixes.push_back({.choices = {i}});
+          }
+          return frontier;
+        });
+    if (!connection.request_work(0) || ::write(ready[1], "x", 1) != 1 ||
+        !connection.rest_after_interrupt()) {
+      ::_exit(1);
+    }
+    ::_exit(0);
+  }
+
+  auto pids = start_workers(1, address, false, ready[0]);
+  pids.push_back(quitter);
+  EXPECT_FALSE(coordinator.run({}));
+  wait_for_workers(pids);
+  ::close(ready[0]);
+  ::close(ready[1]);
+  // The subtrees that the quitter gave back are checked once, as are the
+  // ones that it kept, not the whole tree again.
+  EXPECT_EQ(coordinator.paths(), 2520);
+  EXPECT_EQ(coordinator.steals(), 1);
+}
+
+TEST(Distributed, FindsBadPath)
+{
+  std::string address = ::testing::TempDir() + "coordinator_bad_path";
+  Coordinator coordinator(address);
+  auto pids = start_workers(3, address, true);
+  auto bad_path = coordinator.run({});
+  wait_for_workers(pids);
+
+  ASSERT_TRUE(bad_path);
+  ThreadPool<int, int> pool(1);
+  EXPECT_EQ(pool.run(distributed_experiment(true), *bad_path), bad_path);
+}
+
+TEST(Distributed, InitialPath)
+{
+  std::string address = ::testing::TempDir() + "coordinator_initial_path";
+  Coordinator coordinator(address);
+  auto pids = start_workers(2, address, false);
+  // Action 0 first: 7! / (2^3 * 1) = 630 paths.
+  EXPECT_FALSE(coordinator.run({}, {0}));
+  wait_for_workers(pids);
+  EXPECT_EQ(coordinator.paths(), 630);
+}
+
+} // namespace model
@@ -0,0 +1,349 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/counting_alloc.h"
+#include "model_checker/metrics.h"
+#include "model_checker/replay.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+namespace {
+
+// Every experiment takes (value, size): the shared state and the size of the
+// tree, which the args builder may capture even though build() may not.
+using Experiment2 = ExperimentBuilder<int, int>;
+
+bool
+check_ok(ActionResult res, int & /*value*/, int & /*size*/)
+{
+  return res == ActionResult::kOk;
+}
+
+// `size` actions of one step each: size! paths.
+std::shared_ptr<Experiment2>
+wide_tree(int size)
+{
+  return std::make_shared<Experiment2>(
+      [size]() { return std::make_tuple(0, size); },
+      [](WorkQueue &work_queue, int &value, int &size) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < size; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &value) -> Async {
+                co_await set.bg();
+                value++;
+              },
+              value);
+        }
+        return actions;
+      },
+      check_ok);
+}
+
+// wide_tree() built in place, with a reset(), so that paths stop allocating.
+std::shared_ptr<Experiment2>
+wide_tree_in_place(int size)
+{
+  auto experiment = std::make_shared<Experiment2>(
+      [size]() { return std::make_tuple(0, size); },
+      [](RunnableActionSet &actions, int &value, int &size) {
+        for (int i = 0; i < size; i++) {
+          actions.add_action(
+              [](RunnableActionSet &set, int &value) -> Async {
+                co_await set.bg();
+                value++;
+              },
+              value);
+        }
+      },
+      check_ok);
+  experiment->set_reset([](int &value, int & /*size*/) { value = 0; });
+  return experiment;
+}
+
+// Two actions of `size` steps each: (2 size)! / (size!)^2 paths.
+std::shared_ptr<Experiment2>
+deep_tree(int size)
+{
+  return std::make_shared<Experiment2>(
+      [size]() { return std::make_tuple(0, size); },
+      [](WorkQueue &work_queue, int &value, int &size) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 2; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &value, int steps) -> Async {
+                for (int j = 0; j < steps; j++) {
+                  co_await set.bg();
+                  value++;
+                }
+              },
+              value, int{size});
+        }
+        return actions;
+      },
+      check_ok);
+}
+
+// One action of `size` steps and three of one step: most branch points have
+// one long subtree and a few short ones.
+std::shared_ptr<Experiment2>
+skewed_tree(int size)
+{
+  return std::make_shared<Experiment2>(
+      [size]() { return std::make_tuple(0, size); },
+      [](WorkQueue &work_queue, int &value, int &size) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 4; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &value, int steps) -> Async {
+                for (int j = 0; j < steps; j++) {
+                  co_await set.bg();
+                  value++;
+                }
+              },
+              value, int{i == 0 ? size : 1});
+        }
+        return actions;
+      },
+      check_ok);
+}
+
+// Two actions of two steps, each step making `size` binary choice() calls.
+std::shared_ptr<Experiment2>
+choice_tree(int size)
+{
+  return std::make_shared<Experiment2>(
+      [size]() { return std::make_tuple(0, size); },
+      [](WorkQueue &work_queue, int &value, int &size) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 2; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &value, int choices) -> Async {
+                for (int j = 0; j < 2; j++) {
+                  co_await set.bg();
+                  for (int k = 0; k < choices; k++) {
+                    value += set.choice(2);
+                  }
+                }
+              },
+              value, int{size});
+        }
+        return actions;
+      },
+      check_ok);
+}
+
+// The increment/decrement model of the README, with `size` actions that each
+// add and then subtract: (2 size)! / 2^size paths.
+std::shared_ptr<Experiment2>
+increment_decrement(int size)
+{
+  return std::make_shared<Experiment2>(
+      [size]() { return std::make_tuple(0, size); },
+      [](WorkQueue &work_queue, int &value, int &size) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < size; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &value, int amount) -> Async {
+                co_await set.bg();
+                value += amount;
+                co_await set.bg();
+                value -= amount;
+              },
+              value, int{i + 1});
+        }
+        return actions;
+      },
+      [](ActionResult res, int &value, int & /*size*/) -> bool {
+        return res == ActionResult::kOk && value == 0;
+      });
+}
+
+using Shape = std::shared_ptr<Experiment2> (*)(int);
+
+// Explores the tree on the calling thread, the way a ThreadPool worker does,
+// without any other threads around.
+void
+BM_ExploreSingleThread(benchmark::State &state, Shape shape)
+{
+  auto experiment = shape(static_cast<int>(state.range(0)));
+  size_t paths = 0;
+  size_t before = allocations();
+  std::optional<std::tuple<int, int>> args;
+  std::unique_ptr<RunnableActionSet> set;
+  for (auto _ : state) {
+    WorkQueue work_queue(experiment->search_options());
+    while (!work_queue.done()) {
+      auto built_exp = experiment->build(args);
+      auto *action_set = built_exp.build(work_queue, set);
+      auto res = action_set->run();
+      if (!built_exp.check(res)) {
+        state.SkipWithError("found a bad path");
+        return;
+      }
+      work_queue.advance_cursor();
+      paths++;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+  state.counters["allocs_per_path"] =
+      static_cast<double>(allocations() - before) / static_cast<double>(paths);
+}
+
+// Explores the tree with a ThreadPool of state.range(1) threads.
+void
+BM_ExploreThreads(benchmark::State &state, Shape shape)
+{
+  auto experiment = shape(static_cast<int>(state.range(0)));
+  ThreadPool<int, int> pool(static_cast<int>(state.range(1)));
+  size_t paths = 0;
+  Metrics metrics;
+  for (auto _ : state) {
+    if (pool.run(experiment)) {
+      state.SkipWithError("found a bad path");
+      return;
+    }
+    paths += pool.paths();
+    metrics += pool.metrics();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+  if constexpr (kMetricsEnabled) {
+    // Only known with -DMODEL_CHECKER_METRICS=ON.
+    auto per_run = benchmark::Counter::kAvgIterations;
+    state.counters["steals"] = benchmark::Counter(
+        static_cast<double>(metrics.steals), per_run);
+    state.counters["failed_steals"] = benchmark::Counter(
+        static_cast<double>(metrics.failed_steals), per_run);
+    if (metrics.steals > 0) {
+      state.counters["steal_cycles"] =
+          static_cast<double>(metrics.ticks_in(Phase::kSteal)) /
+          static_cast<double>(metrics.steals);
+    }
+  }
+}
+
+// Replays the first path of deep_tree(state.range(0)), the way run() would
+// from an initial path.
+void
+BM_ReplayWorkQueue(benchmark::State &state)
+{
+  auto experiment = deep_tree(static_cast<int>(state.range(0)));
+  std::vector<uint8_t> path(2 * state.range(0), 0);
+  for (auto _ : state) {
+    WorkQueue work_queue(path);
+    auto built_exp = experiment->build();
+    auto action_set = built_exp.build(work_queue);
+    benchmark::DoNotOptimize(built_exp.check(action_set->run()));
+  }
+}
+
+// The same path through Replay, without a trace.
+void
+BM_Replay(benchmark::State &state)
+{
+  auto experiment = deep_tree(static_cast<int>(state.range(0)));
+  std::vector<uint8_t> path(2 * state.range(0), 0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(replay(*experiment, path, false).ok);
+  }
+}
+
+// A model whose args hold a large pre-sized log, which is rebuilt for every
+// path unless state.range(0) turns on the reset().
+void
+BM_ExploreLargeState(benchmark::State &state)
+{
+  auto experiment = std::make_shared<ExperimentBuilder<std::vector<int>>>(
+      []() { return std::make_tuple(std::vector<int>(1 << 16)); },
+      [](WorkQueue &work_queue, std::vector<int> &log) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 4; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, std::vector<int> &log,
+                 int i) -> Async {
+                co_await set.bg();
+                log[i]++;
+              },
+              log, int{i});
+        }
+        return actions;
+      },
+      [](ActionResult res, std::vector<int> &log) {
+        return res == ActionResult::kOk && log[0] == 1;
+      });
+  if (state.range(0) != 0) {
+    experiment->set_reset([](std::vector<int> &log) {
+      std::fill(log.begin(), log.begin() + 4, 0);
+    });
+  }
+  std::optional<std::tuple<std::vector<int>>> args;
+  size_t paths = 0;
+  for (auto _ : state) {
+    WorkQueue work_queue;
+    while (!work_queue.done()) {
+      auto built_exp = experiment->build(args);
+      auto action_set = built_exp.build(work_queue);
+      if (!built_exp.check(action_set->run())) {
+        state.SkipWithError("found a bad path");
+        return;
+      }
+      work_queue.advance_cursor();
+      paths++;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+}
+
+void
+thread_counts(benchmark::internal::Benchmark *bench, int64_t size)
+{
+  for (int64_t threads = 1; threads <= 64; threads *= 2) {
+    bench->Args({size, threads});
+  }
+  bench->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_CAPTURE(BM_ExploreSingleThread, wide, wide_tree)->Arg(7);
+BENCHMARK_CAPTURE(BM_ExploreSingleThread, deep, deep_tree)->Arg(8);
+BENCHMARK_CAPTURE(BM_ExploreSingleThread, skewed, skewed_tree)->Arg(20);
+BENCHMARK_CAPTURE(BM_ExploreSingleThread, choice, choice_tree)->Arg(3);
+BENCHMARK_CAPTURE(BM_ExploreSingleThread, wide_in_place, wide_tree_in_place)
+    ->Arg(7);
+BENCHMARK_CAPTURE(BM_ExploreSingleThread, increment_decrement,
+                  increment_decrement)
+    ->DenseRange(2, 5);
+
+BENCHMARK(BM_ReplayWorkQueue)->Arg(64);
+BENCHMARK(BM_Replay)->Arg(64);
+BENCHMARK(BM_ExploreLargeState)->Arg(0)->Arg(1);
+
+BENCHMARK_CAPTURE(BM_ExploreThreads, wide, wide_tree)->Apply([](auto *b) {
+  thread_counts(b, 8);
+});
+BENCHMARK_CAPTURE(BM_ExploreThreads, deep, deep_tree)->Apply([](auto *b) {
+  thread_counts(b, 9);
+});
+BENCHMARK_CAPTURE(BM_ExploreThreads, skewed, skewed_tree)->Apply([](auto *b) {
+  thread_counts(b, 30);
+});
+BENCHMARK_CAPTURE(BM_ExploreThreads, choice, choice_tree)->Apply([](auto *b) {
+  thread_counts(b, 4);
+});
+BENCHMARK_CAPTURE(BM_ExploreThreads, increment_decrement, increment_decrement)
+    ->Apply([](auto *b) {
+      for (int64_t size = 3; size <= 5; size++) {
+        thread_counts(b, size);
+      }
+    });
+
+} // namespace
+} // namespace model
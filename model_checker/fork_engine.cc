@@ -0,0 +1,357 @@
+#include "model_checker/fork_engine.h"
+
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <new>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+// Lives in memory that every process of the tree shares.
+struct ForkTree::Shared {
+  // One per process that may run actions.
+  sem_t tokens;
+  std::atomic<bool> cancelled = false;
+};
+
+// What a child sends to its parent: first a segment, once it knows its
+// choices below the parent's snapshot, and then a result, once every path
+// below it is done.  A child that became a snapshot sends kSnapshot before
+// its segment; one that ran its path to the end sends kPath, and its result
+// follows right away.
+enum class ForkTree::Message : uint8_t {
+  kSnapshot = 1,
+  kPath = 2,
+  kResult = 3,
+};
+
+namespace {
+
+// The most snapshot children that a snapshot waits on at once.  Each holds a
+// pipe and, once it exits, a zombie until it is read, so beyond this the
+// snapshot waits for the oldest one before it forks again.
+constexpr size_t kMaxPendingSnapshots = 32;
+
+// A decision of a segment.
+struct SegmentStep {
+  uint8_t choice;
+  uint8_t option_count;
+};
+
+constexpr uint64_t kNoBadPath = ~uint64_t{0};
+
+void
+write_all(int fd, const void *data, size_t size)
+{
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t written = ::write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::perror("fork engine: write");
+      ::_exit(1);
+    }
+    bytes += written;
+    size -= written;
+  }
+}
+
+// Returns false on end of file.
+bool
+read_all(int fd, void *data, size_t size)
+{
+  auto *bytes = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    ssize_t got = ::read(fd, bytes, size);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    bytes += got;
+    size -= got;
+  }
+  return true;
+}
+
+template<typename T>
+void
+write_value(int fd, const T &value)
+{
+  write_all(fd, &value, sizeof(value));
+}
+
+template<typename T>
+bool
+read_value(int fd, T &value)
+{
+  return read_all(fd, &value, sizeof(value));
+}
+
+void
+acquire(sem_t *sem)
+{
+  while (::sem_wait(sem) != 0) {
+    assert(errno == EINTR);
+  }
+}
+
+} // namespace
+
+ForkTree::ForkTree(const ForkOptions &options, size_t initial_path_length)
+  : options_(options), initial_path_length_(initial_path_length)
+{
+  options_.fork_depth = std::max<size_t>(options_.fork_depth, 1);
+  options_.max_processes = std::max<size_t>(options_.max_processes, 1);
+  void *memory = ::mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(), "mmap");
+  }
+  shared_ = new (memory) Shared;
+  if (::sem_init(&shared_->tokens, 1, options_.max_processes) != 0) {
+    throw std::system_error(errno, std::generic_category(), "sem_init");
+  }
+}
+
+ForkTree::~ForkTree()
+{
+  // Only the root gets here; forked processes leave with _exit().
+  ::sem_destroy(&shared_->tokens);
+  shared_->~Shared();
+  ::munmap(shared_, sizeof(Shared));
+}
+
+const std::atomic<bool> *
+ForkTree::cancel_flag() const
+{
+  return &shared_->cancelled;
+}
+
+bool
+ForkTree::at_decision(WorkQueue &work_queue, size_t height)
+{
+  if (!is_child()) {
+    // The root runs no decisions itself.
+    return snapshot(work_queue, height);
+  }
+  if (height < segment_start_ + options_.fork_depth) {
+    return true;
+  }
+  write_segment(work_queue, Message::kSnapshot);
+  // Snapshots do not run actions.
+  ::sem_post(&shared_->tokens);
+  return snapshot(work_queue, height);
+}
+
+bool
+ForkTree::snapshot(WorkQueue &work_queue, size_t height)
+{
+  if (is_child()) {
+    assert(work_queue.decision_count() == height);
+    work_queue.commit_current_path();
+  }
+  segment_start_ = std::max(height, initial_path_length_);
+
+  std::deque<Child> children;
+  while (!work_queue.done() && !work_queue.cancelled()) {
+    if (children.size() >= kMaxPendingSnapshots) {
+      read_result(children.front());
+      children.pop_front();
+      continue;
+    }
+    acquire(&shared_->tokens);
+    int fds[2];
+    if (::pipe(fds) != 0) {
+      ::sem_post(&shared_->tokens);
+      fail("fork engine: pipe");
+      break;
+    }
+    int pid = ::fork();
+    if (pid < 0) {
+      ::sem_post(&shared_->tokens);
+      ::close(fds[0]);
+      ::close(fds[1]);
+      fail("fork engine: fork");
+      break;
+    }
+    if (pid == 0) {
+      ::close(fds[0]);
+      for (const auto &child : children) {
+        ::close(child.fd);
+      }
+      if (out_fd_ >= 0) {
+        ::close(out_fd_);
+      }
+      out_fd_ = fds[1];
+      paths_ = 0;
+      bad_path_ = std::nullopt;
+      return true;
+    }
+    ::close(fds[1]);
+
+    Message message{};
+    uint64_t length = 0;
+    if (!read_value(fds[0], message) || !read_value(fds[0], length)) {
+      // The child died on its way, still holding its token.
+      ::sem_post(&shared_->tokens);
+      ::close(fds[0]);
+      ::waitpid(pid, nullptr, 0);
+      add_result(0, work_queue.get_current_path());
+      break;
+    }
+    assert(message == Message::kSnapshot || message == Message::kPath);
+    for (uint64_t i = 0; i < length; i++) {
+      SegmentStep step{};
+      [[maybe_unused]] bool ok = read_value(fds[0], step);
+      [[maybe_unused]] uint8_t choice =
+          work_queue.get_choice(segment_start_ + i, step.option_count);
+      assert(ok && choice == step.choice);
+    }
+    Child child{
+        .pid = pid, .fd = fds[0], .path = work_queue.get_current_path()};
+    if (message == Message::kPath) {
+      // The result is already on its way.
+      read_result(child);
+    }
+    else {
+      children.push_back(std::move(child));
+    }
+    work_queue.advance_cursor();
+    if (work_queue.decision_count() <= segment_start_) {
+      // Only in the root, which did not commit to its path: a choice above
+      // the snapshot moved on, and this process's state has the old one.
+      break;
+    }
+  }
+
+  for (const auto &child : children) {
+    read_result(child);
+  }
+
+  if (is_child()) {
+    exit_with_result();
+  }
+  return false;
+}
+
+void
+ForkTree::read_result(const Child &child)
+{
+  Message message{};
+  uint64_t paths = 0;
+  uint64_t length = 0;
+  if (!read_value(child.fd, message) || !read_value(child.fd, paths) ||
+      !read_value(child.fd, length)) {
+    // The child died after it went on from this path.
+    add_result(0, child.path);
+  }
+  else if (length == kNoBadPath) {
+    add_result(paths, std::nullopt);
+  }
+  else {
+    std::vector<uint8_t> path(length);
+    read_all(child.fd, path.data(), length);
+    add_result(paths, std::move(path));
+  }
+  ::close(child.fd);
+  ::waitpid(child.pid, nullptr, 0);
+}
+
+void
+ForkTree::fail(const char *what)
+{
+  if (is_child()) {
+    std::perror(what);
+    ::_exit(1);
+  }
+  // The root is the caller's process: stop the other processes and let
+  // check_error() report it once they are done.
+  error_ = errno;
+  error_what_ = what;
+  shared_->cancelled.store(true, std::memory_order_relaxed);
+}
+
+void
+ForkTree::check_error() const
+{
+  if (error_ != 0) {
+    throw std::system_error(error_, std::generic_category(), error_what_);
+  }
+}
+
+void
+ForkTree::add_result(size_t paths, std::optional<std::vector<uint8_t>> bad)
+{
+  paths_ += paths;
+  if (bad && !bad_path_) {
+    bad_path_ = std::move(bad);
+    shared_->cancelled.store(true, std::memory_order_relaxed);
+  }
+}
+
+void
+ForkTree::write_segment(const WorkQueue &work_queue, Message message) const
+{
+  std::vector<uint8_t> path = work_queue.get_current_path();
+  write_value(out_fd_, message);
+  write_value(out_fd_, uint64_t{path.size() - segment_start_});
+  for (size_t height = segment_start_; height < path.size(); height++) {
+    write_value(out_fd_,
+                SegmentStep{.choice = path[height],
+                            .option_count = work_queue.option_count(height)});
+  }
+}
+
+void
+ForkTree::finish_path(const WorkQueue &work_queue, bool counted, bool ok)
+{
+  write_segment(work_queue, Message::kPath);
+  add_result(counted ? 1 : 0,
+             ok ? std::nullopt : std::optional(work_queue.get_current_path()));
+  ::sem_post(&shared_->tokens);
+  exit_with_result();
+}
+
+void
+ForkTree::record_path(const WorkQueue &work_queue, bool ok)
+{
+  add_result(1, ok ? std::nullopt
+                   : std::optional(work_queue.get_current_path()));
+}
+
+void
+ForkTree::exit_with_result() const
+{
+  write_value(out_fd_, Message::kResult);
+  write_value(out_fd_, uint64_t{paths_});
+  if (bad_path_) {
+    write_value(out_fd_, uint64_t{bad_path_->size()});
+    write_all(out_fd_, bad_path_->data(), bad_path_->size());
+  }
+  else {
+    write_value(out_fd_, kNoBadPath);
+  }
+  ::_exit(0);
+}
+
+} // namespace model
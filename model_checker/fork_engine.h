@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#if __has_include(<gtest/gtest.h>)
+#include <gtest/gtest.h>
+#endif
+
+#include "model_checker/async.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+struct ForkOptions {
+  // A process snapshots itself (by forking) every this many decisions, and
+  // each path resumes from the latest snapshot on it.
+  size_t fork_depth = 8;
+  // The number of processes that run actions at the same time.  Snapshots
+  // only wait for their children, and do not count.
+  size_t max_processes = std::thread::hardware_concurrency();
+};
+
+// The process tree of a ForkEngine run, which does not depend on the
+// experiment.
+//
+// A snapshot is a process that stopped at a decision.  It forks one child
+// per path below its current path, one after the other.  A child runs the
+// path on from the snapshot's copy of the actions, and tells the snapshot
+// which choices it made, so that the snapshot's WorkQueue can move on to the
+// next path.  A child that gets fork_depth decisions further becomes a
+// snapshot itself; the others report the result of their path and exit.
+class ForkTree {
+public:
+  ForkTree(const ForkOptions &options, size_t initial_path_length);
+  ~ForkTree();
+
+  // disable copy and move
+  ForkTree(const ForkTree &) = delete;
+  ForkTree &operator=(const ForkTree &) = delete;
+  ForkTree(ForkTree &&) = delete;
+  ForkTree &operator=(ForkTree &&) = delete;
+
+  // Set once some path fails.
+  const std::atomic<bool> *cancel_flag() const;
+
+  // The decision hook.  Returns true in a process that should go on with
+  // the path.  Turns the calling process into a snapshot if it is time to;
+  // a snapshot exits once every path below it is done.  The root instead
+  // returns false once the work queue leaves the subtree below `height`,
+  // with the queue on the next path to build from the start.
+  bool at_decision(WorkQueue &work_queue, size_t height);
+
+  // Whether this is a forked process, which must call finish_path() once
+  // its path ends.
+  bool is_child() const { return out_fd_ >= 0; }
+  // Reports the path to the parent and exits.  `counted` is false if the
+  // path was cancelled.
+  [[noreturn]] void finish_path(const WorkQueue &work_queue, bool counted,
+                                bool ok);
+
+  // For a root process that ran its only path itself.
+  void record_path(const WorkQueue &work_queue, bool ok);
+
+  // Throws std::system_error if the root could not create a pipe or a
+  // process.  The run stops early when that happens, so its result is
+  // incomplete.
+  void check_error() const;
+
+  size_t paths() const { return paths_; }
+  const std::optional<std::vector<uint8_t>> &bad_path() const
+  {
+    return bad_path_;
+  }
+
+private:
+  struct Shared;
+  enum class Message : uint8_t;
+  struct Child {
+    int pid;
+    int fd;
+    // The path down to where the child went on from.
+    std::vector<uint8_t> path;
+  };
+
+  // The snapshot loop.  Returns true in children and false in the root.
+  bool snapshot(WorkQueue &work_queue, size_t height);
+  // Waits for the child's result, and reaps it.
+  void read_result(const Child &child);
+  void add_result(size_t paths, std::optional<std::vector<uint8_t>> bad);
+  // Exits in a forked process; in the root, records the error and cancels
+  // the run.
+  void fail(const char *what);
+  void write_segment(const WorkQueue &work_queue, Message message) const;
+  [[noreturn]] void exit_with_result() const;
+
+  ForkOptions options_;
+  size_t initial_path_length_;
+  Shared *shared_ = nullptr;
+
+  // Where this process reports to its parent; -1 in the root.
+  int out_fd_ = -1;
+  // The height of this process's snapshot, where its segment of the path
+  // starts.
+  size_t segment_start_ = 0;
+
+  size_t paths_ = 0;
+  std::optional<std::vector<uint8_t>> bad_path_;
+
+  // The errno and call of the root's failure, if any.
+  int error_ = 0;
+  const char *error_what_ = nullptr;
+};
+
+// Explores an experiment like ThreadPool, but in processes forked at
+// snapshots instead of threads.  The experiment's args and actions are built
+// once, and each path resumes from a copy-on-write snapshot of the process
+// at most fork_depth decisions back, coroutines and heap included, instead
+// of rebuilding the args and replaying the path from the start.  This pays
+// off when args_builder or the prefix of a path is expensive; otherwise the
+// fork per path costs more than it saves.
+//
+// Call run() from a process without other threads, since fork() only copies
+// the calling thread.  check() runs in the forked processes, so it must
+// report failures by returning false rather than through gtest assertions.
+// Partial order reduction and stateful exploration are not supported.  If a
+// forked process crashes, run() reports the path of the snapshot that it
+// was forked from.  If run() itself cannot create a pipe or a process, it
+// throws std::system_error once the processes it did fork are done.
+template<typename... Args> class ForkEngine {
+public:
+  explicit ForkEngine(ForkOptions options = {}) : options_(options) {}
+
+  // Supply the initial_path with some vector of choices if you wish to check
+  // only a subset of the search space.
+  // returns a bad path, if one is found.
+  [[nodiscard]]
+  std::optional<std::vector<uint8_t>>
+  run(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+      std::vector<uint8_t> initial_path = {})
+  {
+    assert(!experiment->search_options().partial_order_reduction);
+    assert(!experiment->has_state_hash());
+
+    ForkTree tree(options_, initial_path.size());
+    WorkQueue work_queue(std::move(initial_path));
+    work_queue.set_cancel_flag(tree.cancel_flag());
+
+    // The root builds the experiment again for each choice that the actions
+    // make before the first decision, since its state depends on them.
+    while (!work_queue.done() && !work_queue.cancelled()) {
+      auto built_exp = experiment->build();
+      auto action_set = built_exp.build(work_queue);
+      assert(action_set);
+      action_set->set_decision_hook([&tree, &work_queue](size_t height) {
+        return tree.at_decision(work_queue, height);
+      });
+      auto res = action_set->run();
+
+      bool cancelled = res == ActionResult::kCancelled;
+      if (tree.is_child()) {
+        tree.finish_path(work_queue, !cancelled,
+                         cancelled || built_exp.check(res));
+      }
+      if (!cancelled) {
+        // The root only gets here if the experiment made no decisions.
+        tree.record_path(work_queue, built_exp.check(res));
+        work_queue.advance_cursor();
+      }
+    }
+    paths_ = tree.paths();
+    tree.check_error();
+    return tree.bad_path();
+  }
+
+#if __has_include(<gtest/gtest.h>)
+  ::testing::AssertionResult
+  run_test(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+           std::vector<uint8_t> initial_path = {})
+  {
+    auto res = run(experiment, initial_path);
+    if (res.has_value()) {
+      return ::testing::AssertionFailure()
+             << "Found bad path: " << show_path(res.value());
+    }
+    return ::testing::AssertionSuccess();
+  }
+#endif
+
+  // The number of paths that the last run() checked.
+  size_t paths() const { return paths_; }
+
+private:
+  ForkOptions options_;
+  size_t paths_ = 0;
+};
+
+} // namespace model
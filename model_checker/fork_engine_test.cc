@@ -0,0 +1,225 @@
+#include <gtest/gtest.h>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/fork_engine.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+namespace {
+
+// Three actions of two steps each: 6! / 2^3 = 90 paths.
+std::shared_ptr<ExperimentBuilder<int, int>>
+counting_experiment(int *args_built)
+{
+  return std::make_shared<ExperimentBuilder<int, int>>(
+      [args_built]() {
+        (*args_built)++;
+        return std::make_tuple(0, 0);
+      },
+      [](WorkQueue &work_queue, int &a, int &b) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 1; i <= 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &a, int &b, int i) -> Async {
+                co_await set.bg();
+                a += i;
+                co_await set.bg();
+                b += a;
+              },
+              a, b, int{i});
+        }
+        return actions;
+      },
+      [](ActionResult res, int &a, int &b) -> bool {
+        return res == ActionResult::kOk && a == 6 && b > 0;
+      });
+}
+
+// N actions that each yield once: N! paths.
+template<int N>
+std::shared_ptr<ExperimentBuilder<int>>
+wide_experiment()
+{
+  return std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &done) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < N; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &done) -> Async {
+                co_await set.bg();
+                done++;
+              },
+              done);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &done) -> bool {
+        return res == ActionResult::kOk && done == N;
+      });
+}
+
+// Lowers the soft limit on open files for its lifetime.
+class FileLimit {
+public:
+  explicit FileLimit(rlim_t limit)
+  {
+    ::getrlimit(RLIMIT_NOFILE, &saved_);
+    rlimit lowered = saved_;
+    lowered.rlim_cur = limit;
+    ::setrlimit(RLIMIT_NOFILE, &lowered);
+  }
+  ~FileLimit() { ::setrlimit(RLIMIT_NOFILE, &saved_); }
+
+  FileLimit(const FileLimit &) = delete;
+  FileLimit &operator=(const FileLimit &) = delete;
+
+private:
+  rlimit saved_{};
+};
+
+} // namespace
+
+TEST(ForkEngine, ExploresEveryPath)
+{
+  for (size_t fork_depth : {1, 2, 4, 100}) {
+    int args_built = 0;
+    ForkEngine<int, int> engine(
+        ForkOptions{.fork_depth = fork_depth, .max_processes = 4});
+    EXPECT_TRUE(engine.run_test(counting_experiment(&args_built)));
+    EXPECT_EQ(engine.paths(), 90);
+    // Only the root builds the args; everyone else has a copy.
+    EXPECT_EQ(args_built, 1);
+  }
+}
+
+TEST(ForkEngine, ChoiceBeforeFirstDecision)
+{
+  // The first action picks a value while it is added, before the first
+  // scheduling decision.  The path is bad if it picked `bad`.
+  auto experiment = [](int bad) {
+    return std::make_shared<ExperimentBuilder<int, int>>(
+        []() { return std::make_tuple(0, 0); },
+        [](WorkQueue &work_queue, int &picked, int &steps) {
+          auto actions = std::make_unique<RunnableActionSet>(work_queue);
+          actions->add_action(
+              [](RunnableActionSet &set, int &picked, int &steps) -> Async {
+                picked = set.choice(3);
+                co_await set.bg();
+                steps++;
+              },
+              picked, steps);
+          actions->add_action(
+              [](RunnableActionSet &set, int &steps) -> Async {
+                co_await set.bg();
+                steps++;
+              },
+              steps);
+          return actions;
+        },
+        [bad](ActionResult res, int &picked, int &steps) -> bool {
+          return res == ActionResult::kOk && steps == 2 && picked != bad;
+        });
+  };
+
+  ForkEngine<int, int> engine(ForkOptions{.fork_depth = 1});
+  EXPECT_TRUE(engine.run_test(experiment(-1)));
+  // Three choices, each followed by two orders of the steps.
+  EXPECT_EQ(engine.paths(), 6);
+
+  auto bad = experiment(2);
+  auto bad_path = engine.run(bad);
+  ASSERT_TRUE(bad_path);
+  EXPECT_EQ((*bad_path)[0], 2);
+  EXPECT_FALSE(replay(*bad, *bad_path).ok);
+}
+
+TEST(ForkEngine, OneProcessAtATime)
+{
+  int args_built = 0;
+  ForkEngine<int, int> engine(ForkOptions{.fork_depth = 2, .max_processes = 1});
+  EXPECT_TRUE(engine.run_test(counting_experiment(&args_built)));
+  EXPECT_EQ(engine.paths(), 90);
+}
+
+TEST(ForkEngine, InitialPath)
+{
+  int args_built = 0;
+  ForkEngine<int, int> engine(ForkOptions{.fork_depth = 2});
+  EXPECT_TRUE(engine.run_test(counting_experiment(&args_built), {2, 2}));
+  // Action 2 ran both of its steps first: 4! / 2^2 paths are left.
+  EXPECT_EQ(engine.paths(), 6);
+}
+
+TEST(ForkEngine, ManyLeavesFewFiles)
+{
+  // Every snapshot has far more leaves below it than it may hold pipes.
+  FileLimit limit(64);
+  ForkEngine<int> engine(ForkOptions{.fork_depth = 8, .max_processes = 4});
+  EXPECT_TRUE(engine.run_test(wide_experiment<7>()));
+  EXPECT_EQ(engine.paths(), 5040);
+}
+
+TEST(ForkEngine, RootErrorsReachTheCaller)
+{
+  // Leave room for one more file, but not for a pipe.
+  int free_fd = ::dup(0);
+  ASSERT_GE(free_fd, 0);
+  ::close(free_fd);
+  FileLimit limit(free_fd + 1);
+  ForkEngine<int> engine(ForkOptions{.fork_depth = 2});
+  EXPECT_THROW((void)engine.run(wide_experiment<3>()), std::system_error);
+}
+
+TEST(ForkEngine, FindBadPath)
+{
+  ForkEngine<int, int> engine(ForkOptions{.fork_depth = 2});
+  std::shared_ptr<ExperimentBuilder<int, int>> experiment =
+      std::make_shared<ExperimentBuilder<int, int>>(
+          []() { return std::make_tuple(1, 2); },
+          [](WorkQueue &work_queue, int &a, int &b) {
+            auto actions = std::make_unique<RunnableActionSet>(work_queue);
+
+            actions->add_action(
+                [](RunnableActionSet &set, int &a, int &b) -> Async {
+                  co_await set.bg();
+                  if (a == 2) {
+                    b = 3;
+                  }
+                },
+                a, b);
+
+            actions->add_action(
+                [](RunnableActionSet &set, int &a, int & /*b*/) -> Async {
+                  co_await set.bg();
+                  a = 2;
+                  co_await set.bg();
+                  a = 3;
+                },
+                a, b);
+
+            return actions;
+          },
+          [](ActionResult res, int &a, int &b) -> bool {
+            return res == ActionResult::kOk && a == 3 && b == 2;
+          });
+
+  auto bad_path = engine.run(experiment);
+  ASSERT_TRUE(bad_path.has_value());
+  // NOLINTNEXTLINE(bugprone-unchecked-optional-access)
+  EXPECT_EQ(bad_path.value(), std::vector<uint8_t>({1, 0, 0}));
+}
+
+} // namespace model
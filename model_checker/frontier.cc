@@ -0,0 +1,235 @@
+#include "model_checker/frontier.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+namespace {
+
+// The format, in native byte order: the magic, the search options, and one
+// record per prefix (its length, its choices, and with partial order
+// reduction its scheduled and explored masks), up to an end record.
+constexpr char kMagic[8] = {'m', 'c', 'f', 'r', 'o', 'n', 't', '1'};
+constexpr uint32_t kEndRecord = ~uint32_t{0};
+
+struct FileCloser {
+  void operator()(std::FILE *file) const { std::fclose(file); }
+};
+using File = std::unique_ptr<std::FILE, FileCloser>;
+
+// Writes the format through `write(data, size)`, which writes all of the
+// bytes or returns false.
+template<typename Write>
+bool
+encode(const Frontier &frontier, Write &&write)
+{
+  auto value = [&write]<typename T>(const T &value) {
+    return write(&value, sizeof(T));
+  };
+  auto array = [&write]<typename T>(const std::vector<T> &values) {
+    return write(values.data(), values.size() * sizeof(T));
+  };
+  const SearchOptions &options = frontier.options;
+  bool ok = write(kMagic, sizeof(kMagic)) &&
+            value(uint8_t{options.partial_order_reduction}) &&
+            value(uint8_t{options.max_preemptions.has_value()}) &&
+            value(uint64_t{options.max_preemptions.value_or(0)});
+  for (const auto &prefix : frontier.prefixes) {
+    if (!ok) {
+      return false;
+    }
+    ok = value(static_cast<uint32_t>(prefix.choices.size())) &&
+         array(prefix.choices);
+    if (options.partial_order_reduction) {
+      ok = ok && array(prefix.scheduled) && array(prefix.explored);
+    }
+  }
+  return ok && value(kEndRecord);
+}
+
+// Reads the format through `read(data, size)`, which fills all of `data` or
+// returns false.  `available` is the most that `read` can supply, and bounds
+// the lengths in the input before anything is allocated for them.
+template<typename Read>
+std::optional<Frontier>
+decode(Read &&read_input, size_t available)
+{
+  auto read = [&read_input, &available](void *data, size_t size) {
+    if (size > available || !read_input(data, size)) {
+      return false;
+    }
+    available -= size;
+    return true;
+  };
+  auto value = [&read]<typename T>(T &value) {
+    return read(&value, sizeof(T));
+  };
+  auto array = [&read, &available]<typename T>(std::vector<T> &values,
+                                               size_t size) {
+    if (size > available / sizeof(T)) {
+      return false;
+    }
+    values.resize(size);
+    return read(values.data(), size * sizeof(T));
+  };
+  char magic[sizeof(kMagic)];
+  uint8_t partial_order_reduction = 0;
+  uint8_t bounded = 0;
+  uint64_t max_preemptions = 0;
+  if (!read(magic, sizeof(magic)) ||
+      !std::equal(std::begin(magic), std::end(magic), std::begin(kMagic)) ||
+      !value(partial_order_reduction) || !value(bounded) ||
+      !value(max_preemptions)) {
+    return std::nullopt;
+  }
+
+  Frontier frontier;
+  frontier.options.partial_order_reduction = partial_order_reduction != 0;
+  if (bounded != 0) {
+    frontier.options.max_preemptions = max_preemptions;
+  }
+  while (true) {
+    uint32_t length = 0;
+    if (!value(length)) {
+      // Cut short.
+      return std::nullopt;
+    }
+    if (length == kEndRecord) {
+      return frontier;
+    }
+    WorkQueue::Prefix prefix;
+    if (!array(prefix.choices, length)) {
+      return std::nullopt;
+    }
+    if (frontier.options.partial_order_reduction &&
+        (!array(prefix.scheduled, length) || !array(prefix.explored, length))) {
+      return std::nullopt;
+    }
+    frontier.prefixes.push_back(std::move(prefix));
+  }
+}
+
+std::atomic<bool> sigterm_received = false;
+struct sigaction previous_sigterm{};
+
+void
+on_sigterm(int /*signal*/)
+{
+  sigterm_received.store(true);
+}
+
+} // namespace
+
+bool
+write_frontier(const std::string &path, const Frontier &frontier)
+{
+  std::string tmp_path = path + ".tmp";
+  {
+    File file(std::fopen(tmp_path.c_str(), "wb"));
+    if (!file) {
+      return false;
+    }
+    bool ok = encode(frontier, [&file](const void *data, size_t size) {
+      return size == 0 || std::fwrite(data, size, 1, file.get()) == 1;
+    });
+    // On disk before it replaces the last checkpoint.
+    if (!ok || std::fflush(file.get()) != 0 ||
+        ::fsync(::fileno(file.get())) != 0) {
+      int err = errno;
+      file = nullptr;
+      std::remove(tmp_path.c_str());
+      errno = err;
+      return false;
+    }
+  }
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    return false;
+  }
+  // And the rename too.  Not every file system can sync a directory, so
+  // this is best effort.
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return true;
+}
+
+std::optional<Frontier>
+read_frontier(const std::string &path)
+{
+  File file(std::fopen(path.c_str(), "rb"));
+  struct stat info{};
+  if (!file || ::fstat(::fileno(file.get()), &info) != 0) {
+    return std::nullopt;
+  }
+  return decode(
+      [&file](void *data, size_t size) {
+        return size == 0 || std::fread(data, size, 1, file.get()) == 1;
+      },
+      static_cast<size_t>(info.st_size));
+}
+
+std::vector<uint8_t>
+encode_frontier(const Frontier &frontier)
+{
+  std::vector<uint8_t> out;
+  encode(frontier, [&out](const void *data, size_t size) {
+    if (size > 0) {
+      size_t at = out.size();
+      out.resize(at + size);
+      std::memcpy(out.data() + at, data, size);
+    }
+    return true;
+  });
+  return out;
+}
+
+std::optional<Frontier>
+decode_frontier(const std::function<bool(void *, size_t)> &read,
+                size_t available)
+{
+  return decode(read, available);
+}
+
+SigtermGuard::SigtermGuard()
+{
+  sigterm_received.store(false);
+  struct sigaction action{};
+  action.sa_handler = on_sigterm;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGTERM, &action, &previous_sigterm);
+}
+
+SigtermGuard::~SigtermGuard()
+{
+  sigaction(SIGTERM, &previous_sigterm, nullptr);
+}
+
+bool
+SigtermGuard::received()
+{
+  return sigterm_received.load();
+}
+
+} // namespace model
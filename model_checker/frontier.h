@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+// The subtrees that a search has yet to explore, which is all that a later
+// search needs to pick up where it left off (see ThreadPool::resume()).
+struct Frontier {
+  // The options that the search ran with, which the prefixes depend on.
+  SearchOptions options{};
+  std::vector<WorkQueue::Prefix> prefixes{};
+};
+
+// Writes `frontier` to `path` as a stream of prefix records, through a
+// temporary file that replaces `path` once it is complete, so that a crash
+// while writing leaves the last checkpoint intact.  Returns false (and sets
+// errno) if the file could not be written.
+bool write_frontier(const std::string &path, const Frontier &frontier);
+// Returns nullopt if `path` cannot be read or is not a complete frontier.
+std::optional<Frontier> read_frontier(const std::string &path);
+
+// The same format in memory, for sending a frontier to another process.
+std::vector<uint8_t> encode_frontier(const Frontier &frontier);
+// Decodes what encode_frontier() wrote, through `read(data, size)`, which
+// fills all of `data` or returns false.  `available` is the most that `read`
+// can supply: lengths beyond it fail before anything is allocated for them.
+std::optional<Frontier>
+decode_frontier(const std::function<bool(void *, size_t)> &read,
+                size_t available);
+
+struct CheckpointOptions {
+  // Where ThreadPool::run() writes its frontier.  Each checkpoint replaces
+  // the last one.
+  std::string path;
+  // How often to checkpoint; zero for never, except on SIGTERM.
+  std::chrono::milliseconds interval{0};
+  // Checkpoint and stop on SIGTERM, instead of dying.
+  bool on_sigterm = false;
+};
+
+// While alive, SIGTERM only sets a flag instead of ending the process.
+class SigtermGuard {
+public:
+  SigtermGuard();
+  ~SigtermGuard();
+
+  SigtermGuard(const SigtermGuard &) = delete;
+  SigtermGuard &operator=(const SigtermGuard &) = delete;
+  SigtermGuard(SigtermGuard &&) = delete;
+  SigtermGuard &operator=(SigtermGuard &&) = delete;
+
+  // Whether SIGTERM arrived since the guard was installed.
+  static bool received();
+};
+
+} // namespace model
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "model_checker/frontier.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+TEST(Frontier, RoundTrip)
+{
+  std::string path = ::testing::TempDir() + "frontier_round_trip";
+  Frontier frontier{.options = {.partial_order_reduction = true},
+                    .prefixes = {{.choices = {0, 2},
+                                  .scheduled = {~uint32_t{0}, 0b101},
+                                  .explored = {0, 0b1}},
+                                 {}}};
+  ASSERT_TRUE(write_frontier(path, frontier));
+
+  auto read = read_frontier(path);
+  ASSERT_TRUE(read);
+  EXPECT_TRUE(read->options.partial_order_reduction);
+  EXPECT_FALSE(read->options.max_preemptions);
+  ASSERT_EQ(read->prefixes.size(), 2);
+  EXPECT_EQ(read->prefixes[0].choices, frontier.prefixes[0].choices);
+  EXPECT_EQ(read->prefixes[0].scheduled, frontier.prefixes[0].scheduled);
+  EXPECT_EQ(read->prefixes[0].explored, frontier.prefixes[0].explored);
+  EXPECT_TRUE(read->prefixes[1].choices.empty());
+  std::remove(path.c_str());
+}
+
+TEST(Frontier, KeepsThePreemptionBound)
+{
+  std::string path = ::testing::TempDir() + "frontier_bound";
+  Frontier frontier{.options = {.max_preemptions = 2},
+                    .prefixes = {{.choices = {1}}}};
+  ASSERT_TRUE(write_frontier(path, frontier));
+
+  auto read = read_frontier(path);
+  ASSERT_TRUE(read);
+  EXPECT_EQ(read->options.max_preemptions, 2);
+  ASSERT_EQ(read->prefixes.size(), 1);
+  EXPECT_EQ(read->prefixes[0].choices, std::vector<uint8_t>{1});
+  EXPECT_TRUE(read->prefixes[0].scheduled.empty());
+  std::remove(path.c_str());
+}
+
+TEST(Frontier, RejectsBrokenFiles)
+{
+  std::string path = ::testing::TempDir() + "frontier_broken";
+  EXPECT_FALSE(read_frontier(path));
+
+  Frontier frontier{.prefixes = {{.choices = {1, 2, 3}}}};
+  ASSERT_TRUE(write_frontier(path, frontier));
+  // Cut off the end record.
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  std::vector<char> bytes(1024);
+  bytes.resize(std::fread(bytes.data(), 1, bytes.size(), file));
+  std::fclose(file);
+  file = std::fopen(path.c_str(), "wb");
+  std::fwrite(bytes.data(), 1, bytes.size() - 1, file);
+  std::fclose(file);
+  EXPECT_FALSE(read_frontier(path));
+
+  file = std::fopen(path.c_str(), "wb");
+  std::fputs("not a frontier", file);
+  std::fclose(file);
+  EXPECT_FALSE(read_frontier(path));
+  std::remove(path.c_str());
+}
+
+TEST(Frontier, RejectsLengthsPastTheEnd)
+{
+  std::string path = ::testing::TempDir() + "frontier_long";
+  auto bytes = encode_frontier({.prefixes = {{.choices = {1, 2, 3}}}});
+  // The first prefix's length follows the magic and the options.  Claiming
+  // almost 4 GiB must fail before anything is allocated for it.
+  const size_t offset = 8 + 1 + 1 + 8;
+  uint32_t length = ~uint32_t{0} - 1;
+  std::memcpy(bytes.data() + offset, &length, sizeof(length));
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::fclose(file);
+  EXPECT_FALSE(read_frontier(path));
+  std::remove(path.c_str());
+}
+
+} // namespace model
@@ -0,0 +1,74 @@
+#include "model_checker/metrics.h"
+
+#include <cstddef>
+#include <string>
+
+namespace model {
+
+const char *
+phase_name(Phase phase)
+{
+  switch (phase) {
+  case Phase::kOther:
+    return "other";
+  case Phase::kBuild:
+    return "build";
+  case Phase::kActions:
+    return "actions";
+  case Phase::kGetChoice:
+    return "get_choice";
+  case Phase::kAdvanceCursor:
+    return "advance_cursor";
+  case Phase::kSteal:
+    return "steal";
+  case Phase::kCheck:
+    return "check";
+  case Phase::kIdle:
+    return "idle";
+  case Phase::kCount:
+    break;
+  }
+  return "unknown";
+}
+
+Metrics &
+Metrics::operator+=(const Metrics &other)
+{
+  paths += other.paths;
+  steals += other.steals;
+  failed_steals += other.failed_steals;
+  for (size_t i = 0; i < depth_histogram.size(); i++) {
+    depth_histogram[i] += other.depth_histogram[i];
+  }
+  for (size_t i = 0; i < ticks.size(); i++) {
+    ticks[i] += other.ticks[i];
+  }
+  return *this;
+}
+
+std::string
+Metrics::to_json() const
+{
+  std::string out = "{\"paths\": " + std::to_string(paths) +
+                    ", \"steals\": " + std::to_string(steals) +
+                    ", \"failed_steals\": " + std::to_string(failed_steals) +
+                    ", \"depth_histogram\": [";
+  // Trailing empty buckets say nothing.
+  size_t buckets = depth_histogram.size();
+  while (buckets > 0 && depth_histogram[buckets - 1] == 0) {
+    buckets--;
+  }
+  for (size_t i = 0; i < buckets; i++) {
+    out += (i == 0 ? "" : ", ") + std::to_string(depth_histogram[i]);
+  }
+  out += "], \"ticks\": {";
+  for (size_t i = 0; i < ticks.size(); i++) {
+    out += (i == 0 ? "\"" : ", \"");
+    out += phase_name(static_cast<Phase>(i));
+    out += "\": " + std::to_string(ticks[i]);
+  }
+  out += "}}";
+  return out;
+}
+
+} // namespace model
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Build with -DMODEL_CHECKER_METRICS=1 (the CMake option of the same name)
+// to collect Metrics.  Without it, every hook below compiles to nothing.
+#ifndef MODEL_CHECKER_METRICS
+#define MODEL_CHECKER_METRICS 0
+#endif
+
+namespace model {
+
+inline constexpr bool kMetricsEnabled = MODEL_CHECKER_METRICS != 0;
+
+// Where a worker spends its time.  Each phase only counts the time that is
+// not spent in a phase nested inside it, so kActions is the time in the
+// actions themselves, without the get_choice() calls that they make.
+enum class Phase : uint8_t {
+  kOther = 0,
+  // args_builder and build.
+  kBuild,
+  kActions,
+  kGetChoice,
+  kAdvanceCursor,
+  kSteal,
+  kCheck,
+  // Backing off and parked in WorkQueueManager.
+  kIdle,
+  kCount,
+};
+
+const char *phase_name(Phase phase);
+
+// What one worker (or, summed, a whole search) did.
+struct alignas(64) Metrics {
+  // Paths run, including pruned and cancelled ones.
+  size_t paths = 0;
+  size_t steals = 0;
+  // steal_work() calls that came back empty.
+  size_t failed_steals = 0;
+  // depth_histogram[i] counts the paths with std::bit_width(decisions) == i:
+  // bucket 0 holds paths without decisions, bucket i > 0 those with 2^(i-1)
+  // to 2^i - 1.
+  std::array<size_t, 65> depth_histogram{};
+  // Per Phase, in ticks of the processor's cycle counter (of steady_clock
+  // where there is none).
+  std::array<uint64_t, static_cast<size_t>(Phase::kCount)> ticks{};
+
+  uint64_t ticks_in(Phase phase) const
+  {
+    return ticks[static_cast<size_t>(phase)];
+  }
+
+  Metrics &operator+=(const Metrics &other);
+  std::string to_json() const;
+};
+
+namespace metrics {
+
+inline uint64_t
+now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Where the calling thread records, if it does.
+struct ThreadState {
+  Metrics *sink = nullptr;
+  Phase phase = Phase::kOther;
+  // When `phase` started.
+  uint64_t since = 0;
+
+  // Charges the time so far to the current phase and moves on to `next`.
+  // Returns the phase that was running.
+  Phase switch_to(Phase next)
+  {
+    uint64_t t = now();
+    Phase outer = phase;
+    sink->ticks[static_cast<size_t>(outer)] += t - since;
+    phase = next;
+    since = t;
+    return outer;
+  }
+};
+
+inline thread_local ThreadState thread_state;
+
+// While alive, the calling thread records into `sink`.
+class Scope {
+public:
+  explicit Scope([[maybe_unused]] Metrics &sink)
+  {
+    if constexpr (kMetricsEnabled) {
+      thread_state = {.sink = &sink, .phase = Phase::kOther, .since = now()};
+    }
+  }
+  ~Scope()
+  {
+    if constexpr (kMetricsEnabled) {
+      thread_state.switch_to(Phase::kOther);
+      thread_state.sink = nullptr;
+    }
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+  Scope(Scope &&) = delete;
+  Scope &operator=(Scope &&) = delete;
+};
+
+// Charges the time until it goes out of scope to `phase`, and the time
+// before to whatever phase was running.
+class PhaseTimer {
+public:
+  explicit PhaseTimer([[maybe_unused]] Phase phase)
+  {
+    if constexpr (kMetricsEnabled) {
+      if (thread_state.sink != nullptr) {
+        outer_ = thread_state.switch_to(phase);
+        active_ = true;
+      }
+    }
+  }
+  ~PhaseTimer()
+  {
+    if constexpr (kMetricsEnabled) {
+      if (active_) {
+        thread_state.switch_to(outer_);
+      }
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+  PhaseTimer(PhaseTimer &&) = delete;
+  PhaseTimer &operator=(PhaseTimer &&) = delete;
+
+private:
+  Phase outer_ = Phase::kOther;
+  bool active_ = false;
+};
+
+// Returns f(), charging the time that it takes to `phase`.
+template<typename F>
+decltype(auto)
+timed(Phase phase, F &&f)
+{
+  PhaseTimer timer(phase);
+  return f();
+}
+
+// Adds to a counter of the calling thread's Metrics, if it has one.
+template<typename F>
+void
+record([[maybe_unused]] F &&update)
+{
+  if constexpr (kMetricsEnabled) {
+    if (Metrics *sink = thread_state.sink) {
+      update(*sink);
+    }
+  }
+}
+
+inline void
+record_path(size_t decisions)
+{
+  record([decisions](Metrics &m) {
+    m.paths++;
+    m.depth_histogram[std::bit_width(decisions)]++;
+  });
+}
+
+} // namespace metrics
+
+} // namespace model
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <memory>
+#include <tuple>
+
+#include "model_checker/async.h"
+#include "model_checker/metrics.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+TEST(Metrics, Json)
+{
+  Metrics a;
+  a.paths = 2;
+  a.depth_histogram[1] = 2;
+  a.ticks[static_cast<size_t>(Phase::kCheck)] = 7;
+  Metrics b;
+  b.paths = 1;
+  b.steals = 3;
+  b.depth_histogram[2] = 1;
+  a += b;
+  EXPECT_EQ(a.to_json(),
+            "{\"paths\": 3, \"steals\": 3, \"failed_steals\": 0, "
+            "\"depth_histogram\": [0, 2, 1], \"ticks\": {\"other\": 0, "
+            "\"build\": 0, \"actions\": 0, \"get_choice\": 0, "
+            "\"advance_cursor\": 0, \"steal\": 0, \"check\": 7, \"idle\": 0}}");
+}
+
+TEST(Metrics, NestedPhases)
+{
+  if (!kMetricsEnabled) {
+    GTEST_SKIP() << "built without MODEL_CHECKER_METRICS";
+  }
+  Metrics metrics;
+  {
+    metrics::Scope scope(metrics);
+    metrics::PhaseTimer actions(Phase::kActions);
+    {
+      metrics::PhaseTimer choice(Phase::kGetChoice);
+      metrics::record_path(5);
+    }
+  }
+  EXPECT_EQ(metrics.paths, 1);
+  EXPECT_EQ(metrics.depth_histogram[3], 1);
+  EXPECT_GT(metrics.ticks_in(Phase::kGetChoice), 0);
+  // Nothing records once the scope is gone.
+  metrics::record_path(1);
+  EXPECT_EQ(metrics.paths, 1);
+}
+
+TEST(Metrics, ThreadPool)
+{
+  ThreadPool<int> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x == 6;
+      });
+  EXPECT_TRUE(pool.run_test(experiment));
+
+  const Metrics &metrics = pool.metrics();
+  EXPECT_EQ(pool.worker_metrics().size(), 4);
+  if (!kMetricsEnabled) {
+    EXPECT_EQ(metrics.paths, 0);
+    return;
+  }
+  EXPECT_EQ(metrics.paths, 90);
+  // Every path takes 6 decisions, which fall in the bucket for 4 to 7.
+  EXPECT_EQ(metrics.depth_histogram[3], 90);
+  EXPECT_GT(metrics.ticks_in(Phase::kActions), 0);
+  EXPECT_GT(metrics.ticks_in(Phase::kGetChoice), 0);
+  EXPECT_GT(metrics.ticks_in(Phase::kCheck), 0);
+  size_t steals = 0;
+  for (const auto &worker : pool.worker_metrics()) {
+    steals += worker.steals;
+  }
+  EXPECT_EQ(steals, metrics.steals);
+}
+
+} // namespace model
@@ -0,0 +1,69 @@
+#include "model_checker/pct.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "model_checker/state_table.h"
+
+namespace model {
+
+PctStats
+pct_stats(size_t runs, size_t depth, size_t actions, size_t max_steps)
+{
+  PctStats stats{.runs = runs,
+                 .depth = depth,
+                 .actions = actions,
+                 .max_steps = max_steps};
+  if (actions == 0 || depth == 0) {
+    return stats;
+  }
+  double k = std::max<size_t>(max_steps, 1);
+  stats.run_probability =
+      1.0 / (static_cast<double>(actions) * std::pow(k, depth - 1.0));
+  // 1 - (1 - p)^runs, without losing a small p to rounding.
+  stats.probability = -std::expm1(static_cast<double>(runs) *
+                                  std::log1p(-stats.run_probability));
+  return stats;
+}
+
+PctScheduler::PctScheduler(const PctOptions &options, uint64_t run,
+                           size_t max_steps)
+  : rng_(hash_combine(options.seed, run)),
+    depth_(std::max<size_t>(options.depth, 1))
+{
+  // Distinct steps, so that each change point counts towards the depth.
+  // Floyd's sampling: each j adds itself if the step it draws is taken.
+  size_t count = std::min(depth_ - 1, max_steps);
+  for (size_t j = max_steps - count; j < max_steps; j++) {
+    size_t step = std::uniform_int_distribution<size_t>(0, j)(rng_);
+    if (std::ranges::find(change_points_, step) != change_points_.end()) {
+      step = j;
+    }
+    change_points_.push_back(step);
+  }
+  std::ranges::sort(change_points_);
+}
+
+void
+PctScheduler::record(size_t height, uint8_t choice)
+{
+  // Choices come in order, as they do for a WorkQueue.
+  assert(height == path_.size());
+  path_.push_back(choice);
+}
+
+uint8_t
+PctScheduler::get_choice(size_t height, uint8_t n_opts, uint32_t /*action*/)
+{
+  assert(n_opts >= 1);
+  uint8_t choice = std::uniform_int_distribution<int>(0, n_opts - 1)(rng_);
+  record(height, choice);
+  return choice;
+}
+
+} // namespace model
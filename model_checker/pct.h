@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace model {
+
+// Probabilistic Concurrency Testing (Burckhardt et al.): instead of every
+// schedule, run random schedules that are each likely to hit any given bug of
+// small depth.  A bug of depth d needs d ordering constraints between steps of
+// different actions to show up.
+struct PctOptions {
+  // The number of random schedules to run.
+  size_t runs = 1000;
+  // The bug depth to aim for.  Each run changes priorities at depth - 1
+  // random points.
+  size_t depth = 3;
+  // An upper bound on the number of scheduling decisions in a run.  0 means
+  // the longest run that the worker has seen so far, starting from a probe
+  // run without change points that does not count as one of the runs.
+  size_t max_steps = 0;
+  // Runs with the same seed and run number get the same schedule.
+  uint64_t seed = 0;
+};
+
+struct PctStats {
+  size_t runs = 0;
+  size_t depth = 0;
+  // n, the largest number of actions in a run.
+  size_t actions = 0;
+  // k, the largest number of scheduling decisions in a run.
+  size_t max_steps = 0;
+  // Each run hits a given bug of depth d with at least this probability,
+  // 1 / (n k^(d-1)).
+  double run_probability = 0;
+  // Some run hits it with at least 1 - (1 - p)^runs.
+  double probability = 0;
+};
+
+PctStats pct_stats(size_t runs, size_t depth, size_t actions,
+                   size_t max_steps);
+
+// Makes the choices of one PCT run.  Each action gets a random priority when
+// it is first ready, and every scheduling decision runs the ready action with
+// the highest priority.  At depth - 1 distinct random decisions, the action
+// that runs drops to a priority below all of the initial ones.  Other
+// choices (see RunnableActionSet::choice()) are uniformly random.
+//
+// Choices are numbered as for WorkQueue, and path() can be replayed as the
+// initial path of a WorkQueue.  A choice source for
+// RunnableActionSet::run(Source &).  Actions that call choice() before
+// their first bg() only reach it if the run's work queue hands them on (see
+// WorkQueue::set_choice_source()).
+class PctScheduler {
+public:
+  PctScheduler(const PctOptions &options, uint64_t run, size_t max_steps);
+
+  // Like WorkQueue::get_choice().
+  uint8_t get_choice(size_t height, uint8_t n_opts, uint32_t /*action*/ = 0);
+  // Picks one of the ready actions, whose ids `ready[i]` gives in choice
+  // order.
+  template<typename Ready>
+  uint8_t get_action_choice(size_t height, const Ready &ready)
+  {
+    assert(ready.size() > 0);
+    uint8_t choice = 0;
+    for (size_t i = 0; i < ready.size(); i++) {
+      uint32_t id = ready[i];
+      if (id >= priorities_.size()) {
+        priorities_.resize(id + 1, 0);
+      }
+      if (priorities_[id] == 0) {
+        // Above the depth - 1 priorities that change points hand out, and
+        // distinct with overwhelming probability.
+        priorities_[id] = std::max<uint64_t>(rng_(), depth_);
+      }
+      if (priorities_[id] > priorities_[ready[choice]]) {
+        choice = i;
+      }
+    }
+
+    while (next_change_ < change_points_.size() &&
+           change_points_[next_change_] == steps_) {
+      // The first change point drops to depth - 1, the next to depth - 2,
+      // and so on.
+      priorities_[ready[choice]] = depth_ - ++next_change_;
+    }
+    steps_++;
+    record(height, choice);
+    return choice;
+  }
+
+  const std::vector<uint8_t> &path() const { return path_; }
+  // The number of scheduling decisions so far.
+  size_t steps() const { return steps_; }
+  // One past the largest action id seen so far.
+  size_t actions() const { return priorities_.size(); }
+  // The distinct steps, in order, after which the action that ran drops its
+  // priority: depth - 1 of them, or every step if there are fewer.
+  const std::vector<size_t> &change_points() const { return change_points_; }
+
+private:
+  void record(size_t height, uint8_t choice);
+
+  std::mt19937_64 rng_;
+  size_t depth_;
+  // Sorted steps at which the running action drops its priority.
+  std::vector<size_t> change_points_;
+  size_t next_change_ = 0;
+  // By action id; 0 until the action is first ready.
+  std::vector<uint64_t> priorities_;
+  size_t steps_ = 0;
+  std::vector<uint8_t> path_;
+};
+
+} // namespace model
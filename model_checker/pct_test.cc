@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/pct.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+TEST(PctScheduler, SameRunSameSchedule)
+{
+  PctOptions options{.depth = 3, .seed = 7};
+  PctScheduler a(options, 5, 10);
+  PctScheduler b(options, 5, 10);
+  std::vector<uint32_t> ready = {0, 1, 2, 3};
+  for (size_t height = 0; height < 10; height++) {
+    EXPECT_EQ(a.get_action_choice(height, ready),
+              b.get_action_choice(height, ready));
+  }
+  EXPECT_EQ(a.get_choice(10, 4), b.get_choice(10, 4));
+  EXPECT_EQ(a.path(), b.path());
+  EXPECT_EQ(a.path().size(), 11);
+  EXPECT_EQ(a.steps(), 10);
+  EXPECT_EQ(a.actions(), 4);
+}
+
+TEST(PctScheduler, DistinctChangePoints)
+{
+  for (uint64_t run = 0; run < 200; run++) {
+    PctScheduler scheduler(PctOptions{.depth = 5}, run, 6);
+    const auto &points = scheduler.change_points();
+    ASSERT_EQ(points.size(), 4);
+    EXPECT_TRUE(std::ranges::is_sorted(points));
+    EXPECT_EQ(std::ranges::adjacent_find(points), points.end());
+    EXPECT_LT(points.back(), 6);
+  }
+  // More change points than steps: every step gets one.
+  PctScheduler short_run(PctOptions{.depth = 5}, 0, 3);
+  EXPECT_EQ(short_run.change_points(), (std::vector<size_t>{0, 1, 2}));
+}
+
+TEST(PctScheduler, HighestPriorityRunsUntilDone)
+{
+  // Without change points, the action that goes first keeps going.
+  PctScheduler scheduler(PctOptions{.depth = 1}, 0, 10);
+  std::vector<uint32_t> ready = {0, 1, 2};
+  uint32_t first = ready[scheduler.get_action_choice(0, ready)];
+  for (size_t height = 1; height < 5; height++) {
+    EXPECT_EQ(ready[scheduler.get_action_choice(height, ready)], first);
+  }
+}
+
+// Two unsynchronized increments: the update of one is lost if the other
+// reads in between its read and its write.
+std::shared_ptr<ExperimentBuilder<int>>
+lost_update()
+{
+  return std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 2; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                int tmp = x;
+                co_await set.bg();
+                x = tmp + 1;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x == 2;
+      });
+}
+
+TEST(ThreadPool, PctFindsBug)
+{
+  ThreadPool<int> pool(4);
+  auto experiment = lost_update();
+  auto bad = pool.run_pct(experiment, PctOptions{.runs = 200, .depth = 2});
+  ASSERT_TRUE(bad.has_value());
+
+  // The path replays with an exhaustive search.
+  EXPECT_EQ(pool.run(experiment, *bad), bad);
+}
+
+TEST(ThreadPool, PctFirstRunHasChangePoints)
+{
+  // One run per pool: the bug needs a change point, which the first run of a
+  // worker only gets once it has some idea how long a run is.
+  auto experiment = lost_update();
+  size_t found = 0;
+  for (uint64_t seed = 0; seed < 64; seed++) {
+    ThreadPool<int> pool(1);
+    if (pool.run_pct(experiment,
+                     PctOptions{.runs = 1, .depth = 2, .seed = seed})) {
+      found++;
+    }
+    EXPECT_EQ(pool.pct_stats().runs, 1);
+  }
+  EXPECT_GT(found, 0);
+}
+
+TEST(ThreadPool, PctChoicesBeforeFirstStep)
+{
+  // The action picks a value while it is added, before run().
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &picked) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        actions->add_action(
+            [](RunnableActionSet &set, int &picked) -> Async {
+              picked = set.choice(3);
+              co_await set.bg();
+            },
+            picked);
+        return actions;
+      },
+      [](ActionResult res, int &picked) -> bool {
+        return res == ActionResult::kOk && picked != 2;
+      });
+
+  ThreadPool<int> pool(2);
+  auto bad = pool.run_pct(experiment, PctOptions{.runs = 100});
+  ASSERT_TRUE(bad.has_value());
+  EXPECT_EQ((*bad)[0], 2);
+  EXPECT_EQ(pool.run(experiment, *bad), bad);
+}
+
+TEST(ThreadPool, PctStats)
+{
+  ThreadPool<int> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x == 6;
+      });
+
+  EXPECT_FALSE(
+      pool.run_pct(experiment, PctOptions{.runs = 100, .depth = 2}));
+  const auto &stats = pool.pct_stats();
+  EXPECT_EQ(stats.runs, 100);
+  EXPECT_EQ(stats.depth, 2);
+  EXPECT_EQ(stats.actions, 3);
+  EXPECT_EQ(stats.max_steps, 6);
+  EXPECT_DOUBLE_EQ(stats.run_probability, 1.0 / 18);
+  EXPECT_NEAR(stats.probability, 1 - std::pow(17.0 / 18, 100), 1e-12);
+
+  // The pool still runs exhaustive searches afterwards.
+  EXPECT_TRUE(pool.run_test(experiment));
+}
+
+} // namespace model
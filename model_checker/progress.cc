@@ -0,0 +1,29 @@
+#include "model_checker/progress.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace model {
+
+Progress
+estimate_progress(size_t paths, double explored_weight,
+                  std::chrono::duration<double> elapsed)
+{
+  Progress progress{.paths = paths, .elapsed = elapsed};
+  if (elapsed.count() > 0) {
+    progress.paths_per_second = static_cast<double>(paths) / elapsed.count();
+  }
+  // Rounding can take the sum a little past 1.
+  progress.done = std::min(explored_weight, 1.0);
+  if (paths == 0 || progress.done <= 0) {
+    return progress;
+  }
+  progress.estimated_paths = static_cast<double>(paths) / progress.done;
+  // The share of the tree per second is steadier than paths per second,
+  // since paths that get pruned early take next to no time.
+  progress.eta = elapsed * ((1 - progress.done) / progress.done);
+  return progress;
+}
+
+} // namespace model
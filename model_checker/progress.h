@@ -0,0 +1,32 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace model {
+
+// How far a search has got, as reported to ThreadPool::set_progress_callback().
+struct Progress {
+  // The number of paths checked so far.
+  size_t paths = 0;
+  std::chrono::duration<double> elapsed{};
+  double paths_per_second = 0;
+  // The share of the search tree that is done, estimated by Knuth's method:
+  // each path stands for the share of the tree that a random walk down to it
+  // would, with equally likely choices (see WorkQueue::path_weight()).
+  double done = 0;
+  // The number of paths that the search will check in all, estimated as
+  // paths / done.  0 until the first path is checked.
+  double estimated_paths = 0;
+  // The time left at the current rate of progress.
+  std::chrono::duration<double> eta{};
+};
+
+// `explored_weight` is the sum of WorkQueue::path_weight() over the paths
+// that are done.  The estimates only settle once the search has seen a fair
+// sample of the tree; pruning and partial order reduction skip subtrees
+// that never add their weight, so they make it too high.
+Progress estimate_progress(size_t paths, double explored_weight,
+                           std::chrono::duration<double> elapsed);
+
+} // namespace model
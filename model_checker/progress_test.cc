@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/progress.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+TEST(Progress, PathWeightsAddUpToOne)
+{
+  // An uneven tree: the first action picks between one and three more steps.
+  WorkQueue work_queue;
+  double weight = 0;
+  size_t paths = 0;
+  while (!work_queue.done()) {
+    RunnableActionSet set(work_queue);
+    set.add_action([](RunnableActionSet &set) -> Async {
+      co_await set.bg();
+      for (int i = set.choice(3); i >= 0; i--) {
+        co_await set.bg();
+      }
+    });
+    set.add_action([](RunnableActionSet &set) -> Async { co_await set.bg(); });
+    set.run();
+    weight += work_queue.path_weight();
+    paths++;
+    work_queue.advance_cursor();
+  }
+  EXPECT_DOUBLE_EQ(weight, 1);
+  EXPECT_GT(paths, 3);
+}
+
+TEST(Progress, Estimates)
+{
+  auto progress = estimate_progress(100, 0.25, std::chrono::seconds(10));
+  EXPECT_EQ(progress.paths, 100);
+  EXPECT_DOUBLE_EQ(progress.paths_per_second, 10);
+  EXPECT_DOUBLE_EQ(progress.done, 0.25);
+  EXPECT_DOUBLE_EQ(progress.estimated_paths, 400);
+  EXPECT_DOUBLE_EQ(progress.eta.count(), 30);
+
+  auto empty = estimate_progress(0, 0, std::chrono::seconds(0));
+  EXPECT_EQ(empty.estimated_paths, 0);
+  EXPECT_EQ(empty.eta.count(), 0);
+}
+
+} // namespace model
@@ -0,0 +1,28 @@
+#include "model_checker/replay.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace model {
+
+std::string
+show_events(std::span<const ReplayEvent> events)
+{
+  std::string out;
+  for (const auto &event : events) {
+    out += std::to_string(event.height) + ": action " +
+           std::to_string(event.action);
+    if (event.kind == ReplayEvent::Kind::kResume) {
+      out += " resumed, " + std::to_string(event.option_count) + " ready\n";
+    }
+    else {
+      out += " chose " + std::to_string(event.choice) + " of " +
+             std::to_string(event.option_count) + "\n";
+    }
+  }
+  return out;
+}
+
+} // namespace model
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace model {
+
+// Something that happened on a replayed path.
+struct ReplayEvent {
+  enum class Kind : uint8_t {
+    // A scheduling decision resumed `action`, one of `option_count` ready
+    // actions.
+    kResume,
+    // `action` called choice(option_count), which returned `choice`.
+    kChoice,
+  };
+  Kind kind;
+  // The decision's height on the path.
+  size_t height;
+  // The id of the action, in the order that the actions were added.
+  uint32_t action;
+  uint8_t choice;
+  uint8_t option_count;
+};
+
+// A choice source (see RunnableActionSet::run(Source &)) that takes the
+// choices of one path from a flat span instead of a WorkQueue: no locks, no
+// branch points, and nothing that thieves could read.  Decisions past the
+// end of the path take the first option, as a WorkQueue would.
+class Replay {
+public:
+  // `path` must outlive the replay.  Without `trace`, events() stays empty.
+  explicit Replay(std::span<const uint8_t> path, bool trace = true)
+    : path_(path), trace_(trace)
+  {}
+
+  // Like WorkQueue::get_choice(), for choice() calls by `action`.
+  uint8_t get_choice(size_t height, uint8_t n_opts, uint32_t action)
+  {
+    uint8_t choice = next(height, n_opts);
+    if (trace_) {
+      events_.push_back({.kind = ReplayEvent::Kind::kChoice,
+                         .height = height,
+                         .action = action,
+                         .choice = choice,
+                         .option_count = n_opts});
+    }
+    return choice;
+  }
+  // Picks one of the ready actions, whose ids `ready[i]` gives in choice
+  // order.
+  template<typename Ready>
+  uint8_t get_action_choice(size_t height, const Ready &ready)
+  {
+    uint8_t choice = next(height, ready.size());
+    if (trace_) {
+      events_.push_back({.kind = ReplayEvent::Kind::kResume,
+                         .height = height,
+                         .action = ready[choice],
+                         .choice = choice,
+                         .option_count = static_cast<uint8_t>(ready.size())});
+    }
+    return choice;
+  }
+
+  const std::vector<ReplayEvent> &events() const { return events_; }
+  std::vector<ReplayEvent> take_events() { return std::move(events_); }
+  // Whether some choice on the path was out of range for its decision, which
+  // means that the experiment did not make the same decisions as when the
+  // path was recorded.  Such a choice is replaced with the first option.
+  bool diverged() const { return diverged_; }
+  // The number of decisions made past the end of the path.
+  size_t past_end() const { return past_end_; }
+
+private:
+  uint8_t next(size_t height, uint8_t n_opts)
+  {
+    assert(n_opts >= 1);
+    if (height >= path_.size()) {
+      past_end_++;
+      return 0;
+    }
+    uint8_t choice = path_[height];
+    if (choice >= n_opts) {
+      diverged_ = true;
+      return 0;
+    }
+    return choice;
+  }
+
+  std::span<const uint8_t> path_;
+  bool trace_;
+  bool diverged_ = false;
+  size_t past_end_ = 0;
+  std::vector<ReplayEvent> events_;
+};
+
+// One line per event, e.g. "3: action 1 chose 0 of 2".
+std::string show_events(std::span<const ReplayEvent> events);
+
+} // namespace model
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "model_checker/async.h"
+#include "model_checker/replay.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+
+namespace {
+
+// Two actions that each add a chosen amount and then double: the check fails
+// if both choose 1 and both add before either doubles.
+std::shared_ptr<ExperimentBuilder<int>>
+replay_experiment()
+{
+  return std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 2; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x, int i) -> Async {
+                co_await set.bg();
+                x += set.choice(2) * (i + 1);
+                co_await set.bg();
+                x *= 2;
+              },
+              x, int{i});
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x != 12;
+      });
+}
+
+} // namespace
+
+TEST(Replay, ReproducesBadPath)
+{
+  auto experiment = replay_experiment();
+  ThreadPool<int> pool(2);
+  auto bad_path = pool.run(experiment);
+  ASSERT_TRUE(bad_path);
+
+  auto result = replay(*experiment, *bad_path);
+  EXPECT_EQ(result.result, ActionResult::kOk);
+  EXPECT_FALSE(result.ok);
+  EXPECT_FALSE(result.diverged);
+  EXPECT_EQ(result.events.size(), bad_path->size());
+}
+
+TEST(Replay, Trace)
+{
+  auto experiment = replay_experiment();
+  // Action 1 runs and chooses 1 (x = 2), action 0 runs and chooses 1 (x =
+  // 3), and then action 1 and action 0 double it.
+  std::vector<uint8_t> path{1, 1, 0, 1, 1, 0};
+  auto result = replay(*experiment, path);
+  EXPECT_FALSE(result.ok);
+  EXPECT_EQ(show_events(result.events), "0: action 1 resumed, 2 ready\n"
+                                        "1: action 1 chose 1 of 2\n"
+                                        "2: action 0 resumed, 2 ready\n"
+                                        "3: action 0 chose 1 of 2\n"
+                                        "4: action 1 resumed, 2 ready\n"
+                                        "5: action 0 resumed, 1 ready\n");
+
+  EXPECT_TRUE(replay(*experiment, path, false).events.empty());
+}
+
+TEST(Replay, Diverges)
+{
+  auto experiment = replay_experiment();
+  std::vector<uint8_t> path{1, 5};
+  auto result = replay(*experiment, path);
+  EXPECT_TRUE(result.diverged);
+  EXPECT_TRUE(result.ok);
+}
+
+TEST(Replay, ChoiceBeforeFirstStep)
+{
+  // Action 0 picks a value while it is added, before run().
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &picked) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        actions->add_action(
+            [](RunnableActionSet &set, int &picked) -> Async {
+              picked = set.choice(3);
+              co_await set.bg();
+            },
+            picked);
+        return actions;
+      },
+      [](ActionResult res, int &picked) -> bool {
+        return res == ActionResult::kOk && picked != 2;
+      });
+
+  std::vector<uint8_t> path{2, 0};
+  auto result = replay(*experiment, path);
+  EXPECT_FALSE(result.ok);
+  EXPECT_FALSE(result.diverged);
+  EXPECT_EQ(show_events(result.events), "0: action 0 chose 2 of 3\n"
+                                        "1: action 0 resumed, 1 ready\n");
+
+  // Out of range for the choice: the replay diverges, and the action gets
+  // the first option.
+  std::vector<uint8_t> bad{5, 0};
+  result = replay(*experiment, bad);
+  EXPECT_TRUE(result.diverged);
+  EXPECT_TRUE(result.ok);
+  EXPECT_EQ(result.events.front().choice, 0);
+}
+
+} // namespace model
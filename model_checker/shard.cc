@@ -0,0 +1,67 @@
+#include "model_checker/shard.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+namespace model {
+
+namespace {
+
+std::optional<size_t>
+environment_number(const char *name)
+{
+  const char *value = std::getenv(name);
+  if (value == nullptr || *value == '\0') {
+    return std::nullopt;
+  }
+  char *end = nullptr;
+  unsigned long long number = std::strtoull(value, &end, 10);
+  if (*end != '\0') {
+    return std::nullopt;
+  }
+  return number;
+}
+
+} // namespace
+
+std::vector<std::vector<uint8_t>>
+prefixes_of_shard(const std::vector<ShardPrefix> &prefixes,
+                  const Shard &shard)
+{
+  std::vector<size_t> order(prefixes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::stable_sort(order, [&prefixes](size_t a, size_t b) {
+    return prefixes[a].estimated_paths > prefixes[b].estimated_paths;
+  });
+
+  std::vector<double> load(shard.count, 0);
+  std::vector<std::vector<uint8_t>> out;
+  for (size_t idx : order) {
+    // The first of the least loaded, so that ties break the same way in
+    // every shard.
+    size_t target = std::ranges::min_element(load) - load.begin();
+    load[target] += prefixes[idx].estimated_paths;
+    if (target == shard.index) {
+      out.push_back(prefixes[idx].choices);
+    }
+  }
+  return out;
+}
+
+std::optional<Shard>
+shard_from_environment()
+{
+  auto index = environment_number("MODEL_CHECKER_SHARD_INDEX");
+  auto count = environment_number("MODEL_CHECKER_TOTAL_SHARDS");
+  if (!index || !count || *index >= *count) {
+    return std::nullopt;
+  }
+  return Shard{.index = *index, .count = *count};
+}
+
+} // namespace model
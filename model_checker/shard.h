@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace model {
+
+// One of `count` independent runs that split a search between them, for
+// instance one per CI job (see ThreadPool::run()).  Every run enumerates the
+// same prefixes and takes its share, so the runs need not talk to each other.
+struct Shard {
+  size_t index = 0;
+  size_t count = 1;
+  // The depth to split the tree at.  0 picks the shallowest depth that has
+  // kPrefixesPerShard prefixes per shard, so that the shares even out.
+  size_t depth = 0;
+
+  static constexpr size_t kPrefixesPerShard = 8;
+};
+
+// A subtree of the search: the choices down to it, cut short at the depth
+// of the split, and a guess at the number of paths below it.
+struct ShardPrefix {
+  std::vector<uint8_t> choices;
+  double estimated_paths = 1;
+};
+
+// Deals out `prefixes` to the shards, biggest first, each to the shard with
+// the fewest estimated paths so far, and returns the prefixes of
+// `shard.index`.  The same prefixes give every shard the same split.
+std::vector<std::vector<uint8_t>>
+prefixes_of_shard(const std::vector<ShardPrefix> &prefixes,
+                  const Shard &shard);
+
+// The shard given by MODEL_CHECKER_SHARD_INDEX and
+// MODEL_CHECKER_TOTAL_SHARDS, if both are set and make sense.  These are not
+// googletest's variables on purpose: googletest runs each test on one shard
+// only, so a test that read them would check part of its tree and nobody
+// would check the rest.
+std::optional<Shard> shard_from_environment();
+
+} // namespace model
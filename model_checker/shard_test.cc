@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "model_checker/shard.h"
+
+namespace model {
+
+TEST(Shard, BalancesEstimatedPaths)
+{
+  std::vector<ShardPrefix> prefixes{{.choices = {0}, .estimated_paths = 8},
+                                    {.choices = {1}, .estimated_paths = 5},
+                                    {.choices = {2}, .estimated_paths = 4},
+                                    {.choices = {3}, .estimated_paths = 3}};
+  // 8 | 5, then 4 joins 5 and 3 joins 8.
+  EXPECT_EQ(prefixes_of_shard(prefixes, {.index = 0, .count = 2}),
+            (std::vector<std::vector<uint8_t>>{{0}, {3}}));
+  EXPECT_EQ(prefixes_of_shard(prefixes, {.index = 1, .count = 2}),
+            (std::vector<std::vector<uint8_t>>{{1}, {2}}));
+  EXPECT_TRUE(prefixes_of_shard(prefixes, {.index = 4, .count = 5}).empty());
+}
+
+TEST(Shard, FromEnvironment)
+{
+  ::unsetenv("MODEL_CHECKER_SHARD_INDEX");
+  ::unsetenv("MODEL_CHECKER_TOTAL_SHARDS");
+  EXPECT_FALSE(shard_from_environment());
+
+  ::setenv("MODEL_CHECKER_SHARD_INDEX", "2", 1);
+  ::setenv("MODEL_CHECKER_TOTAL_SHARDS", "3", 1);
+  auto shard = shard_from_environment();
+  ASSERT_TRUE(shard);
+  EXPECT_EQ(shard->index, 2);
+  EXPECT_EQ(shard->count, 3);
+
+  ::setenv("MODEL_CHECKER_SHARD_INDEX", "3", 1);
+  EXPECT_FALSE(shard_from_environment());
+  ::setenv("MODEL_CHECKER_SHARD_INDEX", "x", 1);
+  EXPECT_FALSE(shard_from_environment());
+
+  ::unsetenv("MODEL_CHECKER_SHARD_INDEX");
+  ::unsetenv("MODEL_CHECKER_TOTAL_SHARDS");
+}
+
+} // namespace model
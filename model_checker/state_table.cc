@@ -0,0 +1,118 @@
+#include "model_checker/state_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace model {
+
+uint64_t
+hash_combine(uint64_t seed, uint64_t value)
+{
+  // The finalizer of splitmix64.
+  uint64_t x = seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+VisitedStateTable::VisitedStateTable(size_t capacity)
+  : mask_(std::bit_ceil(std::max<size_t>(capacity, 1)) - 1),
+    slots_(std::make_unique<std::atomic<uint64_t>[]>(mask_ + 1))
+{}
+
+bool
+VisitedStateTable::insert(uint64_t hash)
+{
+  if (hash == kEmpty) {
+    hash = 1;
+  }
+  size_t idx = hash & mask_;
+  for (size_t probe = 0; probe < kMaxProbes && probe <= mask_; probe++) {
+    auto &slot = slots_[(idx + probe) & mask_];
+    uint64_t seen = slot.load(std::memory_order_relaxed);
+    if (seen == kEmpty &&
+        slot.compare_exchange_strong(seen, hash, std::memory_order_relaxed)) {
+      size_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    // On failure, `seen` holds whatever another thread put there.
+    if (seen == hash) {
+      return false;
+    }
+  }
+  return true;
+}
+
+StateTableStats
+VisitedStateTable::stats() const
+{
+  // The chance that a new state has the same 64-bit hash as one of the n
+  // states before it.
+  double n = size();
+  return StateTableStats{.states = size(),
+                         .omission_probability = n / std::ldexp(1.0, 64)};
+}
+
+BitstateTable::BitstateTable(size_t bytes, uint8_t hash_count)
+  : bit_mask_(std::bit_ceil(std::max<size_t>(bytes, 8)) * 8 - 1),
+    hash_count_(hash_count),
+    words_(std::make_unique<std::atomic<uint64_t>[]>(bit_count() / 64))
+{
+  assert(hash_count_ >= 1);
+}
+
+bool
+BitstateTable::insert(uint64_t hash)
+{
+  // Double hashing: the i-th bit is h1 + i * h2.
+  uint64_t h1 = hash;
+  uint64_t h2 = hash_combine(hash, hash_count_) | 1;
+  bool inserted = false;
+  for (uint8_t i = 0; i < hash_count_; i++) {
+    size_t bit = (h1 + i * h2) & bit_mask_;
+    auto &word = words_[bit / 64];
+    uint64_t mask = uint64_t{1} << (bit % 64);
+    // Most bits of a busy table are set already, and a plain load leaves the
+    // cache line shared between workers.
+    if ((word.load(std::memory_order_relaxed) & mask) == 0 &&
+        (word.fetch_or(mask, std::memory_order_relaxed) & mask) == 0) {
+      inserted = true;
+    }
+  }
+  if (inserted) {
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return inserted;
+}
+
+StateTableStats
+BitstateTable::stats() const
+{
+  // The chance that all k bits of a new state were set by the n states before
+  // it, (1 - e^(-kn/m))^k.  It only grows as the table fills up, so this is
+  // the worst case over the run.
+  double n = size_.load(std::memory_order_relaxed);
+  double k = hash_count_;
+  double m = bit_count();
+  return StateTableStats{
+      .states = size_.load(std::memory_order_relaxed),
+      .omission_probability = std::pow(-std::expm1(-k * n / m), k)};
+}
+
+std::unique_ptr<StateTable>
+make_state_table(const StateTableOptions &options)
+{
+  if (options.bitstate_bytes != 0) {
+    return std::make_unique<BitstateTable>(options.bitstate_bytes,
+                                           options.bitstate_hash_count);
+  }
+  return std::make_unique<VisitedStateTable>(options.capacity);
+}
+
+} // namespace model
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace model {
+
+// Mixes `value` into `seed`.  Handy for writing state hash functions.
+uint64_t hash_combine(uint64_t seed, uint64_t value);
+
+struct StateTableStats {
+  // The number of distinct states recorded.
+  size_t states = 0;
+  // The expected probability that a state was wrongly taken for one that was
+  // seen before, so that its subtree was never explored.
+  double omission_probability = 0;
+};
+
+// The set of states that some path has already reached, shared by every
+// worker of a search.  States are identified by a 64-bit hash.
+class StateTable {
+public:
+  virtual ~StateTable() = default;
+
+  // Returns true if `hash` was (probably) not in the table yet.
+  virtual bool insert(uint64_t hash) = 0;
+  virtual StateTableStats stats() const = 0;
+};
+
+// Lookups and inserts never block: the table is a fixed-size open addressing
+// array of hashes, updated with compare-and-swap.  Only full hash collisions
+// can prune a subtree that was never explored.
+class VisitedStateTable : public StateTable {
+public:
+  // `capacity` is rounded up to a power of two.
+  explicit VisitedStateTable(size_t capacity);
+
+  // disable copy and move
+  VisitedStateTable(const VisitedStateTable &) = delete;
+  VisitedStateTable &operator=(const VisitedStateTable &) = delete;
+  VisitedStateTable(VisitedStateTable &&) = delete;
+  VisitedStateTable &operator=(VisitedStateTable &&) = delete;
+
+  // Once the table (or the neighbourhood of `hash`) is full, new states are
+  // reported as unseen but not remembered, which costs time but never misses
+  // a state.
+  bool insert(uint64_t hash) override;
+  StateTableStats stats() const override;
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  // Zero marks an empty slot.
+  static constexpr uint64_t kEmpty = 0;
+  static constexpr size_t kMaxProbes = 64;
+
+  size_t mask_;
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  std::atomic<size_t> size_ = 0;
+};
+
+// Holzmann's bitstate hashing (supertrace): each state sets `hash_count` bits
+// of a fixed-size bit array, and counts as seen if all of them were set
+// already.  Memory stays fixed however many states there are, at the price of
+// omitting some states, more and more as the array fills up.
+class BitstateTable : public StateTable {
+public:
+  // `bytes` is rounded up to a power of two.
+  explicit BitstateTable(size_t bytes, uint8_t hash_count = 3);
+
+  // disable copy and move
+  BitstateTable(const BitstateTable &) = delete;
+  BitstateTable &operator=(const BitstateTable &) = delete;
+  BitstateTable(BitstateTable &&) = delete;
+  BitstateTable &operator=(BitstateTable &&) = delete;
+
+  bool insert(uint64_t hash) override;
+  StateTableStats stats() const override;
+
+  size_t bit_count() const { return bit_mask_ + 1; }
+
+private:
+  size_t bit_mask_;
+  uint8_t hash_count_;
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+  std::atomic<size_t> size_ = 0;
+};
+
+struct StateTableOptions {
+  // The number of states that a VisitedStateTable remembers.
+  size_t capacity = size_t{1} << 20;
+  // If nonzero, use a BitstateTable of this many bytes instead.
+  size_t bitstate_bytes = 0;
+  uint8_t bitstate_hash_count = 3;
+};
+
+std::unique_ptr<StateTable> make_state_table(const StateTableOptions &options);
+
+} // namespace model
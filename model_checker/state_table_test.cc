@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "model_checker/state_table.h"
+
+namespace model {
+
+TEST(VisitedStateTable, Insert)
+{
+  VisitedStateTable table(100);
+  EXPECT_EQ(table.capacity(), 128);
+
+  EXPECT_TRUE(table.insert(5));
+  EXPECT_TRUE(table.insert(0));
+  EXPECT_TRUE(table.insert(5 + 128));
+  EXPECT_FALSE(table.insert(5));
+  EXPECT_FALSE(table.insert(0));
+  EXPECT_FALSE(table.insert(5 + 128));
+  EXPECT_EQ(table.size(), 3);
+}
+
+TEST(VisitedStateTable, FullTableForgets)
+{
+  VisitedStateTable table(4);
+  for (uint64_t i = 1; i <= 4; i++) {
+    EXPECT_TRUE(table.insert(i));
+  }
+  // Nothing is ever pruned by mistake; the new state just is not remembered.
+  EXPECT_TRUE(table.insert(5));
+  EXPECT_TRUE(table.insert(5));
+  EXPECT_FALSE(table.insert(4));
+  EXPECT_EQ(table.size(), 4);
+}
+
+TEST(VisitedStateTable, ConcurrentInserts)
+{
+  VisitedStateTable table(1 << 16);
+  std::atomic<size_t> inserted = 0;
+  {
+    std::vector<std::jthread> threads;
+    for (uint64_t t = 0; t < 4; t++) {
+      threads.emplace_back([&, t] {
+        // Every thread overlaps with the next one.
+        for (uint64_t i = t * 1000; i < t * 1000 + 2000; i++) {
+          if (table.insert(hash_combine(0, i))) {
+            inserted++;
+          }
+        }
+      });
+    }
+  }
+  EXPECT_EQ(inserted, 5000);
+  EXPECT_EQ(table.size(), 5000);
+}
+
+TEST(BitstateTable, Insert)
+{
+  BitstateTable table(1000, 3);
+  EXPECT_EQ(table.bit_count(), 1024 * 8);
+  EXPECT_EQ(table.stats().omission_probability, 0);
+
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_TRUE(table.insert(hash_combine(0, i)));
+  }
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_FALSE(table.insert(hash_combine(0, i)));
+  }
+  auto stats = table.stats();
+  EXPECT_EQ(stats.states, 100);
+  // (1 - e^(-300/8192))^3
+  EXPECT_NEAR(stats.omission_probability, 4.65e-5, 1e-7);
+}
+
+TEST(BitstateTable, OmissionsGrowAsTheTableFills)
+{
+  BitstateTable table(8, 2);
+  size_t inserted = 0;
+  for (uint64_t i = 0; i < 1000; i++) {
+    inserted += table.insert(hash_combine(0, i)) ? 1 : 0;
+  }
+  // 64 bits cannot tell 1000 states apart.
+  EXPECT_LT(inserted, 200);
+  EXPECT_EQ(table.stats().states, inserted);
+  EXPECT_GT(table.stats().omission_probability, 0.5);
+}
+
+TEST(StateTable, MakeStateTable)
+{
+  auto visited = make_state_table(StateTableOptions{.capacity = 16});
+  EXPECT_NE(dynamic_cast<VisitedStateTable *>(visited.get()), nullptr);
+
+  auto bitstate = make_state_table(StateTableOptions{.bitstate_bytes = 16});
+  EXPECT_NE(dynamic_cast<BitstateTable *>(bitstate.get()), nullptr);
+}
+
+} // namespace model
@@ -1,16 +1,20 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <future>
 #include <latch>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <stop_token>
 #include <thread>
 #include <tuple>
@@ -23,37 +27,111 @@
 #endif
 
 #include "model_checker/async.h"
+#include "model_checker/frontier.h"
+#include "model_checker/metrics.h"
+#include "model_checker/pct.h"
+#include "model_checker/progress.h"
+#include "model_checker/replay.h"
+#include "model_checker/shard.h"
+#include "model_checker/state_table.h"
 #include "model_checker/work_queue.h"
 
 namespace model {
 
+template<typename... Args> class ExperimentBuilder;
+
 // Experiment and ExperimentBuilder are my attempt at making it hard to mis-use
 // this library with accidental captures in the lambdas.
+//
+// An Experiment is one path's worth of state.  It calls the builder's
+// functions in place rather than copying them, so the builder has to outlive
+// it.
 template<typename... Args> class Experiment {
 public:
-  Experiment(
-      std::function<std::tuple<Args...>()> &args_builder,
-      std::function<std::unique_ptr<RunnableActionSet>(WorkQueue &, Args &...)>
-          build,
-      std::function<bool(ActionResult, Args &...)> check)
-    : args_(args_builder()), build_(build), check_(check)
+  explicit Experiment(const ExperimentBuilder<Args...> &builder,
+                      StateTable *states = nullptr)
+    : own_args_(builder.args_()), args_(*own_args_), builder_(builder),
+      states_(states)
+  {}
+  // Runs in `args`, which the caller keeps.
+  Experiment(const ExperimentBuilder<Args...> &builder,
+             std::tuple<Args...> &args, StateTable *states = nullptr)
+    : args_(args), builder_(builder), states_(states)
   {}
 
+  ~Experiment()
+  {
+    // The actions refer to the args, which the next experiment may replace.
+    if (set_ != nullptr && *set_ != nullptr) {
+      (*set_)->clear();
+    }
+  }
+
   std::unique_ptr<RunnableActionSet> build(WorkQueue &work_queue)
   {
+    assert(!builder_.runs_paths());
+    assert(state_ == ExperimentState::kInitialized);
+    state_ = ExperimentState::kRunning;
+    std::unique_ptr<RunnableActionSet> action_set;
+    if (builder_.build_ != nullptr) {
+      action_set = [&]<size_t... I>(std::index_sequence<I...>) {
+        return builder_.build_(work_queue, std::get<I>(args_)...);
+      }(std::make_index_sequence<sizeof...(Args)>());
+    }
+    else {
+      action_set = std::make_unique<RunnableActionSet>(work_queue);
+      build_in_place(*action_set);
+    }
+    if (action_set) {
+      add_hooks(*action_set);
+    }
+    return action_set;
+  }
+  // Likewise, but in `set`, which the caller keeps from one experiment to
+  // the next.  If the builder builds in place, the set is reset and reused,
+  // and otherwise it is replaced.  Its actions are destroyed along with this
+  // experiment.
+  RunnableActionSet *build(WorkQueue &work_queue,
+                           std::unique_ptr<RunnableActionSet> &set)
+  {
+    set_ = &set;
+    if (builder_.build_in_place_ == nullptr || set == nullptr) {
+      set = build(work_queue);
+      return set.get();
+    }
+    assert(state_ == ExperimentState::kInitialized);
+    state_ = ExperimentState::kRunning;
+    set->reset(work_queue);
+    build_in_place(*set);
+    add_hooks(*set);
+    return set.get();
+  }
+
+  // Runs the current path of `work_queue`, for an experiment that runs its
+  // own paths instead of building actions.
+  ActionResult run(WorkQueue &work_queue)
+  {
+    assert(builder_.runs_paths());
+    assert(states_ == nullptr && !builder_.invariant_);
+    assert(!work_queue.options().max_preemptions);
     assert(state_ == ExperimentState::kInitialized);
     state_ = ExperimentState::kRunning;
     return [&]<size_t... I>(std::index_sequence<I...>) {
-      return build_(work_queue, std::get<I>(args_)...);
+      return builder_.run_(work_queue, std::get<I>(args_)...);
     }(std::make_index_sequence<sizeof...(Args)>());
   }
 
+  // A path that broke the step invariant fails without calling check(),
+  // since the actions stopped partway.
   bool check(ActionResult res)
   {
     assert(state_ == ExperimentState::kRunning);
     state_ = ExperimentState::kChecked;
+    if (res == ActionResult::kInvariantViolated) {
+      return false;
+    }
     return [&]<size_t... I>(std::index_sequence<I...>) {
-      return check_(res, std::get<I>(args_)...);
+      return builder_.check_(res, std::get<I>(args_)...);
     }(std::make_index_sequence<sizeof...(Args)>());
   }
 
@@ -64,16 +142,43 @@ public:
   Experiment &operator=(Experiment &&) = delete;
 
 private:
+  void build_in_place(RunnableActionSet &set)
+  {
+    [&]<size_t... I>(std::index_sequence<I...>) {
+      builder_.build_in_place_(set, std::get<I>(args_)...);
+    }(std::make_index_sequence<sizeof...(Args)>());
+  }
+
+  void add_hooks(RunnableActionSet &set)
+  {
+    if (states_ != nullptr) {
+      set.track_states(*states_, [this] {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+          return builder_.state_hash_(std::get<I>(args_)...);
+        }(std::make_index_sequence<sizeof...(Args)>());
+      });
+    }
+    if (builder_.invariant_) {
+      set.set_step_invariant([this] {
+        return [&]<size_t... I>(std::index_sequence<I...>) {
+          return builder_.invariant_(std::get<I>(args_)...);
+        }(std::make_index_sequence<sizeof...(Args)>());
+      });
+    }
+  }
+
   enum class ExperimentState {
     kInitialized = 0,
     kRunning = 1,
     kChecked = 2,
   };
 
-  std::tuple<Args...> args_;
-  std::function<std::unique_ptr<RunnableActionSet>(WorkQueue &, Args &...)>
-      build_;
-  std::function<bool(ActionResult, Args &...)> check_;
+  std::optional<std::tuple<Args...>> own_args_;
+  std::tuple<Args...> &args_;
+  const ExperimentBuilder<Args...> &builder_;
+  StateTable *states_;
+  // The caller's set, if built with one.
+  std::unique_ptr<RunnableActionSet> *set_ = nullptr;
   ExperimentState state_ = ExperimentState::kInitialized;
 };
 
@@ -82,25 +187,208 @@ private:
 // valid. args() and check() are allowed to capture state, but build() is not.
 // It's too easy to then use that captured state in an action, which can then
 // cause an error.
+//
+// args() and check() are type-erased once, here, and build() is kept as the
+// plain function pointer that it has to be, so building an Experiment for
+// each path copies none of them.
 template<typename... Args> class ExperimentBuilder {
 public:
+  using BuildFn = std::unique_ptr<RunnableActionSet> (*)(WorkQueue &,
+                                                         Args &...);
+  // Adds the actions to a set that is already on the path's work queue.
+  using BuildInPlaceFn = void (*)(RunnableActionSet &, Args &...);
+  // Runs the current path of the queue itself, for actions that are not
+  // coroutines (see checkpointed_experiment()).
+  using RunFn = ActionResult (*)(WorkQueue &, Args &...);
+
+  ExperimentBuilder(std::function<std::tuple<Args...>()> args, BuildFn build,
+                    std::function<bool(ActionResult, Args &...)> check)
+    : build_(build), check_(std::move(check)), args_(std::move(args))
+  {}
+  // Each ThreadPool worker builds every path in one set of its own, which
+  // keeps its memory from path to path (see RunnableActionSet::reset()).
+  // Together with set_reset(), a path then does not touch the heap once the
+  // worker has run the largest paths.
   ExperimentBuilder(std::function<std::tuple<Args...>()> args,
-                    std::unique_ptr<RunnableActionSet> (*build)(WorkQueue &,
-                                                                Args &...),
+                    BuildInPlaceFn build,
+                    std::function<bool(ActionResult, Args &...)> check)
+    : build_in_place_(build), check_(std::move(check)), args_(std::move(args))
+  {}
+  // Only ThreadPool's unsharded searches (run(), resume() and run_test())
+  // run such an experiment, and without a state hash, an invariant, a
+  // preemption bound or partial order reduction.
+  ExperimentBuilder(std::function<std::tuple<Args...>()> args, RunFn run,
                     std::function<bool(ActionResult, Args &...)> check)
-    : build_(build), check_(check), args_(args)
+    : run_(run), check_(std::move(check)), args_(std::move(args))
   {}
 
-  Experiment<Args...> build()
+  // disable copy and move, since experiments refer to the builder.
+  ExperimentBuilder(const ExperimentBuilder &) = delete;
+  ExperimentBuilder &operator=(const ExperimentBuilder &) = delete;
+  ExperimentBuilder(ExperimentBuilder &&) = delete;
+  ExperimentBuilder &operator=(ExperimentBuilder &&) = delete;
+
+  // `states` is where the experiment records the states that it reaches, if
+  // it has a state hash.
+  Experiment<Args...> build(StateTable *states = nullptr) const
+  {
+    return Experiment<Args...>(*this, states);
+  }
+  // Likewise, but in `args`, which the caller keeps from one experiment to
+  // the next.  The first experiment fills it in with args(), and later ones
+  // reset() it, or build it again if there is no reset().
+  Experiment<Args...> build(std::optional<std::tuple<Args...>> &args,
+                            StateTable *states = nullptr) const
+  {
+    if (args && reset_) {
+      std::apply(reset_, *args);
+    }
+    else {
+      args.emplace(args_());
+    }
+    return Experiment<Args...>(*this, *args, states);
+  }
+
+  // Applies to every run of this experiment.
+  void set_search_options(const SearchOptions &options) { options_ = options; }
+  const SearchOptions &search_options() const { return options_; }
+
+  // Whether paths go through Experiment::run() instead of a
+  // RunnableActionSet.
+  bool runs_paths() const { return run_ != nullptr; }
+
+  // Turns on stateful exploration: paths that reach a state some other path
+  // already reached are cut short (see RunnableActionSet::track_states()).
+  // `state_hash` must cover all of the state in the args, since two states
+  // with the same hash are treated as the same state.  `table_options` picks
+  // the kind and size of the table.
+  void set_state_hash(std::function<uint64_t(Args &...)> state_hash,
+                      StateTableOptions table_options = {})
+  {
+    state_hash_ = std::move(state_hash);
+    state_table_options_ = table_options;
+  }
+  bool has_state_hash() const { return state_hash_ != nullptr; }
+
+  // Checks `invariant` before the first step and after every step, instead
+  // of only at the end of the path (see
+  // RunnableActionSet::set_step_invariant()).  A path stops at the first
+  // step that breaks it, and that prefix is the bad path, so failing paths
+  // are as short as they can be and nothing below them is explored.  Not
+  // supported together with partial order reduction.
+  void set_invariant(std::function<bool(Args &...)> invariant)
+  {
+    invariant_ = std::move(invariant);
+  }
+
+  // Lets each worker keep one instance of the args for all of its paths,
+  // instead of calling args() for every path.  `reset` has to put the args
+  // back into the state that args() builds, for example by clearing
+  // containers without giving up their capacity.
+  void set_reset(std::function<void(Args &...)> reset)
+  {
+    reset_ = std::move(reset);
+  }
+  const StateTableOptions &state_table_options() const
   {
-    return Experiment<Args...>(args_, build_, check_);
+    return state_table_options_;
   }
 
 private:
-  std::function<std::unique_ptr<RunnableActionSet>(WorkQueue &, Args &...)>
-      build_;
+  friend class Experiment<Args...>;
+
+  BuildFn build_ = nullptr;
+  BuildInPlaceFn build_in_place_ = nullptr;
+  RunFn run_ = nullptr;
   std::function<bool(ActionResult, Args &...)> check_;
   std::function<std::tuple<Args...>()> args_;
+  SearchOptions options_;
+  std::function<uint64_t(Args &...)> state_hash_;
+  StateTableOptions state_table_options_;
+  std::function<void(Args &...)> reset_;
+  std::function<bool(Args &...)> invariant_;
+};
+
+// The subtrees of `experiment` at `depth`: the paths of the tree, each cut
+// short at its first scheduling decision at `depth` or below, and an
+// estimate of the number of paths below each one.  The estimate is the
+// product of the option counts along the first path below the prefix,
+// Knuth's estimate for the walk that always takes the first option.  Not
+// supported with partial order reduction, whose subtrees depend on what
+// other subtrees find.
+template<typename... Args>
+std::vector<ShardPrefix>
+frontier_at_depth(ExperimentBuilder<Args...> &experiment, size_t depth)
+{
+  const SearchOptions &options = experiment.search_options();
+  assert(!options.partial_order_reduction);
+  std::vector<ShardPrefix> out;
+  WorkQueue work_queue(options);
+  while (!work_queue.done()) {
+    auto built_exp = experiment.build();
+    auto action_set = built_exp.build(work_queue);
+    assert(action_set);
+    action_set->set_decision_hook(
+        [depth](size_t height) { return height < depth; });
+    action_set->run();
+    out.push_back({.choices = work_queue.get_current_path()});
+    work_queue.advance_cursor();
+  }
+
+  for (auto &prefix : out) {
+    WorkQueue probe(prefix.choices, options);
+    auto built_exp = experiment.build();
+    auto action_set = built_exp.build(probe);
+    action_set->run();
+    for (size_t height = prefix.choices.size();
+         height < probe.decision_count(); height++) {
+      prefix.estimated_paths *= probe.option_count(height);
+    }
+  }
+  return out;
+}
+
+struct ReplayResult {
+  // What RunnableActionSet::run() returned.
+  ActionResult result = ActionResult::kOk;
+  // What check() said about the path.
+  bool ok = true;
+  std::vector<ReplayEvent> events;
+  bool diverged = false;
+};
+
+// Runs `experiment` down `path` once, on the calling thread, for a debugger
+// or a loop that shrinks a bad path.  The experiment's state hash and search
+// options are ignored, since the path fixes every decision.
+template<typename... Args>
+ReplayResult
+replay(ExperimentBuilder<Args...> &experiment, std::span<const uint8_t> path,
+       bool trace = true)
+{
+  // Only there to hand the choices that actions make while they are added
+  // to the replay.
+  WorkQueue work_queue;
+  Replay source(path, trace);
+  work_queue.set_choice_source(source);
+  auto built_exp = experiment.build();
+  auto action_set = built_exp.build(work_queue);
+  assert(action_set);
+  ReplayResult out;
+  out.result = action_set->run(source);
+  out.ok = built_exp.check(out.result);
+  out.events = source.take_events();
+  out.diverged = source.diverged();
+  return out;
+}
+
+// How one bound of ThreadPool::run_preemption_bounded() went.
+struct PreemptionBoundStats {
+  size_t max_preemptions = 0;
+  // The paths checked with this bound, including the ones that lower bounds
+  // checked already.
+  size_t paths = 0;
+  // Whether the bound kept some path from switching actions.
+  bool hit_bound = false;
 };
 
 template<typename... Args> class ThreadPool {
@@ -128,35 +416,207 @@ public:
   run(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
       std::vector<uint8_t> initial_path = {})
   {
-    barrier_.emplace(workers_.size());
-    finish_ = false;
-    {
-      std::scoped_lock g(mtx_);
-      work_queue_manager_ =
-          std::make_unique<WorkQueueManager>(workers_.size(),
-                                             std::move(initial_path));
-      experiment_ = experiment;
+    const SearchOptions &options = experiment->search_options();
+    return run(experiment,
+               std::make_unique<WorkQueueManager>(
+                   workers_.size(), std::move(initial_path), options),
+               options);
+  }
 
-      cv_.notify_all();
+  // Explores `shard`'s share of the tree (see Shard and prefixes_of_shard()).
+  // The shards of a search check every path between them, each path once.
+  [[nodiscard]]
+  std::optional<std::vector<uint8_t>>
+  run(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+      const Shard &shard)
+  {
+    assert(shard.index < shard.count);
+    std::vector<ShardPrefix> frontier;
+    if (shard.depth > 0) {
+      frontier = frontier_at_depth(*experiment, shard.depth);
+    }
+    else {
+      // Deeper until there are enough prefixes, or no path is long enough
+      // to split any further.
+      for (size_t depth = 1;; depth++) {
+        frontier = frontier_at_depth(*experiment, depth);
+        bool cut = std::ranges::any_of(frontier, [depth](const auto &prefix) {
+          return prefix.choices.size() >= depth;
+        });
+        if (!cut || frontier.size() >= Shard::kPrefixesPerShard * shard.count) {
+          break;
+        }
+      }
     }
 
-    barrier_->wait();
-    work_queue_manager_ = nullptr;
-    experiment_ = nullptr;
-    finish_ = true;
-    finish_.notify_all();
+    const SearchOptions &options = experiment->search_options();
+    std::vector<WorkQueue::Prefix> prefixes;
+    for (auto &choices : prefixes_of_shard(frontier, shard)) {
+      prefixes.push_back({.choices = std::move(choices)});
+    }
+    return run(experiment,
+               std::make_unique<WorkQueueManager>(workers_.size(),
+                                                  std::move(prefixes), options),
+               options);
+  }
 
-    auto out = std::move(bad_path_);
-    bad_path_ = std::nullopt;
+  // Picks up a search where a checkpoint left off (see
+  // set_checkpoint_options()), with the search options that it was saved
+  // with.  Paths that were under way when the checkpoint was taken are
+  // checked again.
+  [[nodiscard]]
+  std::optional<std::vector<uint8_t>>
+  resume(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+         Frontier frontier)
+  {
+    SearchOptions options = frontier.options;
+    return run(experiment,
+               std::make_unique<WorkQueueManager>(
+                   workers_.size(), std::move(frontier.prefixes), options),
+               options);
+  }
+
+  // Explores with preemption bounds 0, 1, 2, and so on up to
+  // max_preemptions (see SearchOptions::max_preemptions), and returns the
+  // first bad path found, which run() can replay as its initial path.  Bugs
+  // that need few preemptions show up early, since the number of paths only
+  // grows polynomially with the bound.  Stops early once a bound kept no
+  // path from switching, since that bound explored every path.  Not
+  // supported with partial order reduction.
+  [[nodiscard]]
+  std::optional<std::vector<uint8_t>>
+  run_preemption_bounded(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+                         size_t max_preemptions)
+  {
+    preemption_bound_stats_.clear();
+    SearchOptions options = experiment->search_options();
+    for (size_t bound = 0; bound <= max_preemptions; bound++) {
+      options.max_preemptions = bound;
+      auto out = run(experiment,
+                     std::make_unique<WorkQueueManager>(
+                         workers_.size(), std::vector<uint8_t>{}, options),
+                     options);
+      bool hit_bound = std::ranges::any_of(
+          search_workers_, &SearchWorker::hit_preemption_bound);
+      preemption_bound_stats_.push_back(
+          {.max_preemptions = bound, .paths = paths_, .hit_bound = hit_bound});
+      if (out || !hit_bound) {
+        return out;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // One entry per bound that the last run_preemption_bounded() explored.
+  const std::vector<PreemptionBoundStats> &preemption_bound_stats() const
+  {
+    return preemption_bound_stats_;
+  }
+
+  // The number of paths that the last run() checked.
+  size_t paths() const { return paths_; }
+
+  // What the workers of the last run() did, if the library was built with
+  // MODEL_CHECKER_METRICS (see Metrics); all zero otherwise.
+  const Metrics &metrics() const { return metrics_; }
+  const std::vector<Metrics> &worker_metrics() const { return worker_metrics_; }
+
+  // Has run() report its progress to `callback` every `interval`, from a
+  // thread of its own, and once more from run() when the search is done.
+  // Pass nullptr to stop reporting.  Not called by run_pct().
+  void set_progress_callback(std::function<void(const Progress &)> callback,
+                             std::chrono::milliseconds interval =
+                                 std::chrono::seconds(1))
+  {
+    progress_callback_ = std::move(callback);
+    progress_interval_ = interval;
+  }
+
+  // Has run() and resume() save the work that they have left to
+  // options.path, which resume() can pick up from after a crash or a
+  // restart.  A run that finishes without finding a bad path leaves an empty
+  // frontier behind.  Not used by run_pct().
+  void set_checkpoint_options(CheckpointOptions options)
+  {
+    checkpoint_options_ = std::move(options);
+  }
+
+  // Stops the run in progress once every worker is between two paths, and
+  // returns the work that it had left, which resume() can pick up.  Returns
+  // nullopt if no run is in progress or it finishes first.  Called from
+  // another thread than the one in run().
+  std::optional<Frontier> interrupt()
+  {
+    std::lock_guard lock(interrupt_mtx_);
+    if (interruptible_ == nullptr) {
+      return std::nullopt;
+    }
+    auto prefixes = interruptible_->snapshot(true);
+    if (!prefixes) {
+      return std::nullopt;
+    }
+    interrupted_ = true;
+    return Frontier{interruptible_options_, std::move(*prefixes)};
+  }
+
+  // Whether the last run() stopped early, on SIGTERM (see
+  // CheckpointOptions::on_sigterm) or through interrupt().
+  bool interrupted() const { return interrupted_; }
+
+  // Runs options.runs random schedules of the experiment instead of every
+  // path (see PctScheduler), and returns the path of a failing one, if any,
+  // which run() can replay as its initial path.  Worker i runs schedules i,
+  // i + n, i + 2n, and so on, with nothing shared between workers until one
+  // of them fails.  The state hash and the search options of the experiment
+  // are ignored.
+  [[nodiscard]]
+  std::optional<std::vector<uint8_t>>
+  run_pct(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+          const PctOptions &options)
+  {
+    pct_options_ = options;
+    pct_workers_.assign(workers_.size(), PctWorker{});
+    auto out = run(experiment);
+    pct_options_ = std::nullopt;
+
+    PctWorker total;
+    for (const auto &worker : pct_workers_) {
+      total.runs += worker.runs;
+      total.actions = std::max(total.actions, worker.actions);
+      total.max_steps = std::max(total.max_steps, worker.max_steps);
+    }
+    pct_stats_ =
+        model::pct_stats(total.runs, options.depth, total.actions,
+                         options.max_steps > 0 ? options.max_steps
+                                               : total.max_steps);
     return out;
   }
 
+  // The guarantee that the last run_pct() gives.
+  const PctStats &pct_stats() const { return pct_stats_; }
+
+  // What the state table of the last run() recorded, if it had one.  The
+  // omission probability says how likely it is that the state table hid a
+  // state from the search.
+  const std::optional<StateTableStats> &state_table_stats() const
+  {
+    return state_table_stats_;
+  }
+
 #if __has_include(<gtest/gtest.h>)
+  // Only explores a shard of the tree if shard_from_environment() says so,
+  // there is no initial path, partial order reduction is off, and the
+  // experiment does not run its own paths.
   ::testing::AssertionResult
   run_test(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
            std::vector<uint8_t> initial_path = {})
   {
-    auto res = run(experiment, initial_path);
+    auto shard = shard_from_environment();
+    bool sharded = shard && initial_path.empty() &&
+                   !experiment->search_options().partial_order_reduction &&
+                   !experiment->runs_paths();
+    auto res = sharded ? run(experiment, *shard)
+                       : run(experiment, std::move(initial_path));
     if (res.has_value()) {
       return ::testing::AssertionFailure()
              << "Found bad path: " << show_path(res.value());
@@ -177,14 +637,203 @@ private:
   // null if no active work
   std::unique_ptr<WorkQueueManager> work_queue_manager_;
   std::shared_ptr<ExperimentBuilder<Args...>> experiment_;
+  // null unless the experiment has a state hash
+  std::unique_ptr<StateTable> state_table_;
+  std::optional<StateTableStats> state_table_stats_;
   std::promise<void> promise_;
   std::optional<std::latch> barrier_;
-  std::atomic<bool> finish_ = false;
+  // A worker waits for this to move on before it looks for the next run, so
+  // that a run that starts right away cannot hide the end of the last one.
+  std::atomic<uint64_t> finished_runs_ = 0;
 
   std::vector<std::jthread> workers_;
 
   std::optional<std::vector<uint8_t>> bad_path_;
 
+  // Set for the duration of run_pct().
+  std::optional<PctOptions> pct_options_;
+  // Padded so that workers do not share cache lines.
+  struct alignas(64) PctWorker {
+    size_t runs = 0;
+    size_t actions = 0;
+    size_t max_steps = 0;
+  };
+  std::vector<PctWorker> pct_workers_;
+  PctStats pct_stats_;
+
+  // Only the worker itself writes its counters, so relaxed loads and stores
+  // do; the atomics only let the progress reporter read them as they change.
+  struct alignas(64) SearchWorker {
+    std::atomic<size_t> paths = 0;
+    // The sum of WorkQueue::path_weight() over the paths done.
+    std::atomic<double> explored_weight = 0;
+    bool hit_preemption_bound = false;
+    Metrics metrics;
+  };
+  std::vector<SearchWorker> search_workers_;
+  size_t paths_ = 0;
+  Metrics metrics_;
+  std::vector<Metrics> worker_metrics_;
+  std::function<void(const Progress &)> progress_callback_;
+  std::chrono::milliseconds progress_interval_{};
+
+  Progress progress(std::chrono::steady_clock::time_point start) const
+  {
+    size_t paths = 0;
+    double explored_weight = 0;
+    for (const auto &worker : search_workers_) {
+      paths += worker.paths.load(std::memory_order_relaxed);
+      explored_weight += worker.explored_weight.load(std::memory_order_relaxed);
+    }
+    return estimate_progress(paths, explored_weight,
+                             std::chrono::steady_clock::now() - start);
+  }
+
+  void report_progress(const std::stop_token &stoken,
+                       std::chrono::steady_clock::time_point start) const
+  {
+    std::mutex mtx;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mtx);
+    // Nobody notifies cv; it is only there to sleep until the stop request.
+    while (!cv.wait_for(lock, stoken, progress_interval_,
+                        [&stoken] { return stoken.stop_requested(); })) {
+      progress_callback_(progress(start));
+    }
+  }
+  std::vector<PreemptionBoundStats> preemption_bound_stats_;
+
+  CheckpointOptions checkpoint_options_;
+  std::atomic<bool> interrupted_ = false;
+  // The manager of the run in progress, for interrupt(); not owned.
+  std::mutex interrupt_mtx_;
+  WorkQueueManager *interruptible_ = nullptr;
+  SearchOptions interruptible_options_;
+
+  bool checkpointing() const
+  {
+    return !checkpoint_options_.path.empty() && !pct_options_ &&
+           (checkpoint_options_.interval.count() > 0 ||
+            checkpoint_options_.on_sigterm);
+  }
+
+  void save(Frontier frontier) const
+  {
+    if (!write_frontier(checkpoint_options_.path, frontier)) {
+      std::perror(checkpoint_options_.path.c_str());
+    }
+  }
+
+  void checkpoint_loop(const std::stop_token &stoken,
+                       WorkQueueManager *manager, const SearchOptions &options)
+  {
+    // A signal handler cannot notify anyone, so SIGTERM is polled for.
+    constexpr std::chrono::milliseconds kPollInterval(10);
+    const auto interval = checkpoint_options_.interval;
+    auto next = std::chrono::steady_clock::now() + interval;
+    std::mutex mtx;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mtx);
+    while (!cv.wait_for(lock, stoken, kPollInterval,
+                        [&stoken] { return stoken.stop_requested(); })) {
+      bool stop = checkpoint_options_.on_sigterm && SigtermGuard::received();
+      if (!stop && (interval.count() == 0 ||
+                    std::chrono::steady_clock::now() < next)) {
+        continue;
+      }
+      auto prefixes = manager->snapshot(stop);
+      if (!prefixes) {
+        // The search is over.
+        return;
+      }
+      save({options, std::move(*prefixes)});
+      if (stop) {
+        interrupted_ = true;
+        return;
+      }
+      next = std::chrono::steady_clock::now() + interval;
+    }
+  }
+
+  std::optional<std::vector<uint8_t>>
+  run(std::shared_ptr<ExperimentBuilder<Args...>> experiment,
+      std::unique_ptr<WorkQueueManager> manager, const SearchOptions &options)
+  {
+    barrier_.emplace(workers_.size());
+    interrupted_ = false;
+    std::optional<SigtermGuard> sigterm;
+    if (checkpointing() && checkpoint_options_.on_sigterm) {
+      sigterm.emplace();
+    }
+    state_table_stats_ = std::nullopt;
+    search_workers_ = std::vector<SearchWorker>(workers_.size());
+    auto start = std::chrono::steady_clock::now();
+    std::optional<std::jthread> reporter;
+    if (progress_callback_ && !pct_options_) {
+      reporter.emplace([this, start](const std::stop_token &stoken) {
+        report_progress(stoken, start);
+      });
+    }
+    {
+      std::scoped_lock g(mtx_);
+      work_queue_manager_ = std::move(manager);
+      if (experiment->has_state_hash()) {
+        state_table_ = make_state_table(experiment->state_table_options());
+      }
+      experiment_ = experiment;
+
+      cv_.notify_all();
+    }
+    if (!pct_options_) {
+      std::lock_guard lock(interrupt_mtx_);
+      interruptible_ = work_queue_manager_.get();
+      interruptible_options_ = options;
+    }
+    std::optional<std::jthread> checkpointer;
+    if (checkpointing()) {
+      checkpointer.emplace([this, manager = work_queue_manager_.get(),
+                            &options](const std::stop_token &stoken) {
+        checkpoint_loop(stoken, manager, options);
+      });
+    }
+
+    barrier_->wait();
+    {
+      // Waits for an interrupt() that is still taking its snapshot.
+      std::lock_guard lock(interrupt_mtx_);
+      interruptible_ = nullptr;
+    }
+    checkpointer = std::nullopt;
+    sigterm = std::nullopt;
+    if (checkpointing() && !interrupted_ && !bad_path_) {
+      save({options, {}});
+    }
+    reporter = std::nullopt;
+    if (progress_callback_ && !pct_options_) {
+      progress_callback_(progress(start));
+    }
+    work_queue_manager_ = nullptr;
+    experiment_ = nullptr;
+    if (state_table_) {
+      state_table_stats_ = state_table_->stats();
+    }
+    state_table_ = nullptr;
+    paths_ = 0;
+    metrics_ = Metrics{};
+    worker_metrics_.clear();
+    for (const auto &worker : search_workers_) {
+      paths_ += worker.paths.load(std::memory_order_relaxed);
+      metrics_ += worker.metrics;
+      worker_metrics_.push_back(worker.metrics);
+    }
+    finished_runs_++;
+    finished_runs_.notify_all();
+
+    auto out = std::move(bad_path_);
+    bad_path_ = std::nullopt;
+    return out;
+  }
+
   // worker_loop is the main loop run by each worker thread.
   void worker_loop(const std::stop_token &stoken, size_t worker_id)
   {
@@ -192,6 +841,8 @@ private:
       WorkQueueManager *work_queue_manager = nullptr;
       using experiment_type = decltype(experiment_)::element_type;
       experiment_type *experiment = nullptr;
+      StateTable *state_table = nullptr;
+      uint64_t run = 0;
       {
         std::unique_lock lk(mtx_);
         cv_.wait(lk, stoken, [this] { return work_queue_manager_ != nullptr; });
@@ -202,41 +853,144 @@ private:
         assert(experiment_ != nullptr);
         work_queue_manager = work_queue_manager_.get();
         experiment = experiment_.get();
+        state_table = state_table_.get();
+        run = finished_runs_.load();
       }
 
-      while (true) {
-        auto *work_queue = work_queue_manager->get_work_queue(worker_id);
-        if (!work_queue) {
-          barrier_->arrive_and_wait();
-          // make sure that the loop doesn't run again
-          finish_.wait(false);
-          break;
-        }
-
-        assert(!work_queue->done());
-        auto built_exp = experiment->build();
-        auto action_set = built_exp.build(*work_queue);
+      if (pct_options_) {
+        pct_loop(worker_id, work_queue_manager, experiment);
+      }
+      else {
+        search_loop(worker_id, work_queue_manager, experiment, state_table);
+      }
+      // Not arrive_and_wait(): the next run may replace barrier_ as soon as
+      // the last worker counts down.
+      barrier_->count_down();
+      // make sure that the loop doesn't run again
+      finished_runs_.wait(run);
+    }
+  }
 
+  void search_loop(size_t worker_id, WorkQueueManager *work_queue_manager,
+                   ExperimentBuilder<Args...> *experiment,
+                   StateTable *state_table)
+  {
+    auto &stats = search_workers_[worker_id];
+    metrics::Scope metrics_scope(stats.metrics);
+    // Reused from path to path if the experiment has a reset(), and if it
+    // builds in place.
+    std::optional<std::tuple<Args...>> args;
+    std::unique_ptr<RunnableActionSet> set;
+    while (auto *work_queue = work_queue_manager->get_work_queue(worker_id)) {
+      assert(!work_queue->done());
+      auto built_exp = metrics::timed(
+          Phase::kBuild, [&] { return experiment->build(args, state_table); });
+      // Null if the experiment runs its own paths.
+      RunnableActionSet *action_set = nullptr;
+      if (!experiment->runs_paths()) {
+        action_set = metrics::timed(
+            Phase::kBuild, [&] { return built_exp.build(*work_queue, set); });
         assert(action_set);
-        auto res = action_set->run();
-
-        auto check_res = built_exp.check(res);
+      }
+      auto res = metrics::timed(Phase::kActions, [&] {
+        return action_set != nullptr ? action_set->run()
+                                     : built_exp.run(*work_queue);
+      });
+      metrics::record_path(work_queue->decision_count());
+      if (res != ActionResult::kCancelled) {
+        // A pruned path still covers its share of the tree.
+        stats.explored_weight.store(
+            stats.explored_weight.load(std::memory_order_relaxed) +
+                work_queue->path_weight(),
+            std::memory_order_relaxed);
+      }
+      if (res != ActionResult::kPruned && res != ActionResult::kCancelled) {
+        stats.paths.store(stats.paths.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+      }
+      if (action_set != nullptr) {
+        stats.hit_preemption_bound |= action_set->hit_preemption_bound();
+      }
 
-        // TODO(geoff): maybe instead return a bool to top level result
-        if (!check_res) {
-          std::lock_guard lock(mtx_);
-          if (!bad_path_) {
-            bad_path_ = work_queue->get_current_path();
-          }
-          work_queue_manager->shortcircuit_done();
+      // A pruned path stops partway, and its subtree is checked elsewhere.
+      // A cancelled one stops partway because another worker failed.
+      bool check_res = res == ActionResult::kPruned ||
+                       res == ActionResult::kCancelled ||
+                       metrics::timed(Phase::kCheck,
+                                      [&] { return built_exp.check(res); });
+
+      // TODO(geoff): maybe instead return a bool to top level result
+      if (!check_res) {
+        std::lock_guard lock(mtx_);
+        if (!bad_path_) {
+          bad_path_ = work_queue->get_current_path();
         }
+        work_queue_manager->shortcircuit_done();
+      }
+
+      work_queue->advance_cursor();
+      work_queue_manager->at_safe_point(worker_id);
+
+      if (!work_queue->done()) {
+        work_queue_manager->mark_self_as_stealable(worker_id);
+      }
+    }
+  }
 
-        work_queue->advance_cursor();
+  void pct_loop(size_t worker_id, WorkQueueManager *work_queue_manager,
+                ExperimentBuilder<Args...> *experiment)
+  {
+    const PctOptions &options = *pct_options_;
+    auto &stats = pct_workers_[worker_id];
+    std::optional<std::tuple<Args...>> args;
+    std::unique_ptr<RunnableActionSet> set;
+    // Returns false if the run was cancelled.
+    auto run = [&](PctScheduler &scheduler) {
+      // Only there to cancel the run, and to hand the choices that actions
+      // make while they are added to the scheduler.
+      WorkQueue work_queue;
+      work_queue.set_cancel_flag(work_queue_manager->cancel_flag());
+      work_queue.set_choice_source(scheduler);
+
+      auto built_exp = experiment->build(args);
+      auto *action_set = built_exp.build(work_queue, set);
+      assert(action_set);
+      auto res = action_set->run(scheduler);
+      if (res == ActionResult::kCancelled) {
+        return false;
+      }
 
-        if (!work_queue->done()) {
-          work_queue_manager->mark_self_as_stealable(worker_id);
+      stats.actions = std::max(stats.actions, scheduler.actions());
+      stats.max_steps = std::max(stats.max_steps, scheduler.steps());
+      if (!built_exp.check(res)) {
+        std::lock_guard lock(mtx_);
+        if (!bad_path_) {
+          bad_path_ = scheduler.path();
         }
+        work_queue_manager->shortcircuit_done();
+      }
+      return true;
+    };
+
+    if (options.max_steps == 0 && worker_id < options.runs) {
+      // Change points fall within the longest run seen so far, so the first
+      // run would get none.  A probe run without them, numbered past the
+      // real ones, measures a run first.
+      PctScheduler probe(options, options.runs + worker_id, 0);
+      if (!run(probe)) {
+        return;
+      }
+    }
+    for (size_t i = worker_id;
+         i < options.runs && !work_queue_manager->done();
+         i += workers_.size()) {
+      PctScheduler scheduler(options, i,
+                             options.max_steps > 0 ? options.max_steps
+                                                   : stats.max_steps);
+      if (!run(scheduler)) {
+        break;
       }
+      stats.runs++;
     }
   }
 };
@@ -0,0 +1,59 @@
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <tuple>
+
+#include "model_checker/async.h"
+#include "model_checker/threadpool.h"
+#include "model_checker/work_queue.h"
+
+namespace model {
+namespace {
+
+// The shape of the ThreadPool.Stealing test: five actions of two steps each,
+// 113400 paths.
+std::shared_ptr<ExperimentBuilder<int, int>>
+stealing_experiment()
+{
+  return std::make_shared<ExperimentBuilder<int, int>>(
+      []() { return std::make_tuple(0, 0); },
+      [](WorkQueue &work_queue, int &a, int &b) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 1; i <= 5; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &a, int &b, int i) -> Async {
+                co_await set.bg();
+                a += i;
+                co_await set.bg();
+                b += i;
+              },
+              a, b, int{i});
+        }
+        return actions;
+      },
+      [](ActionResult res, int &a, int &b) -> bool {
+        return res == ActionResult::kOk && a == 15 && b == 15;
+      });
+}
+
+void
+BM_ThreadPoolStealing(benchmark::State &state)
+{
+  ThreadPool<int, int> pool(static_cast<int>(state.range(0)));
+  auto experiment = stealing_experiment();
+  for (auto _ : state) {
+    if (pool.run(experiment)) {
+      state.SkipWithError("found a bad path");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 113400);
+}
+BENCHMARK(BM_ThreadPoolStealing)
+    ->RangeMultiplier(2)
+    ->Range(1, 64)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+} // namespace model
@@ -1,11 +1,22 @@
 #include <gtest/gtest.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <string>
+#include <thread>
 #include <tuple>
 #include <vector>
 
 #include "model_checker/async.h"
+#include "model_checker/frontier.h"
+#include "model_checker/progress.h"
+#include "model_checker/state_table.h"
 #include "model_checker/threadpool.h"
 #include "model_checker/work_queue.h"
 
@@ -44,6 +55,142 @@ TEST(ThreadPool, Basic)
   EXPECT_TRUE(pool.run_test(experiment));
 }
 
+// Counts the copies made of it.
+struct CopyCounter {
+  explicit CopyCounter(std::atomic<int> &copies) : copies(&copies) {}
+  CopyCounter(const CopyCounter &other) : copies(other.copies) { ++*copies; }
+  CopyCounter &operator=(const CopyCounter &) = delete;
+
+  std::atomic<int> *copies;
+};
+
+TEST(ThreadPool, PathsDoNotCopyTheCallables)
+{
+  std::atomic<int> copies = 0;
+  CopyCounter counter(copies);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      [counter]() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [counter](ActionResult res, int &x) {
+        return res == ActionResult::kOk && x == 3;
+      });
+  int before = copies.load();
+
+  ThreadPool<int> pool(2);
+  EXPECT_FALSE(pool.run(experiment));
+  EXPECT_EQ(pool.paths(), 6);
+  EXPECT_EQ(copies.load(), before);
+}
+
+TEST(ThreadPool, ResetReusesTheArgs)
+{
+  constexpr size_t kCapacity = 1024;
+  std::atomic<int> builds = 0;
+  auto experiment = std::make_shared<ExperimentBuilder<std::vector<int>>>(
+      [&builds]() {
+        builds++;
+        std::vector<int> log;
+        log.reserve(kCapacity);
+        return std::make_tuple(std::move(log));
+      },
+      [](WorkQueue &work_queue, std::vector<int> &log) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 4; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, std::vector<int> &log,
+                 int i) -> Async {
+                co_await set.bg();
+                log.push_back(i);
+              },
+              log, int{i});
+        }
+        return actions;
+      },
+      [](ActionResult res, std::vector<int> &log) {
+        return res == ActionResult::kOk && log.size() == 4 &&
+               log.capacity() >= kCapacity;
+      });
+  experiment->set_reset([](std::vector<int> &log) { log.clear(); });
+
+  ThreadPool<std::vector<int>> pool(2);
+  EXPECT_FALSE(pool.run(experiment));
+  EXPECT_EQ(pool.paths(), 24);
+  // Once per worker that got any work.
+  EXPECT_GE(builds.load(), 1);
+  EXPECT_LE(builds.load(), 2);
+}
+
+TEST(ThreadPool, StepInvariantStopsAtTheFirstViolation)
+{
+  // Both actions can be inside at once, but each leaves before it ends, so
+  // the final state looks fine.
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &inside) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 2; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &inside) -> Async {
+                co_await set.bg();
+                inside++;
+                co_await set.bg();
+                inside--;
+              },
+              inside);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &inside) {
+        return res == ActionResult::kOk && inside == 0;
+      });
+
+  ThreadPool<int> pool(1);
+  EXPECT_FALSE(pool.run(experiment));
+
+  experiment->set_invariant([](int &inside) { return inside <= 1; });
+  auto bad_path = pool.run(experiment);
+  ASSERT_TRUE(bad_path);
+  // Each action takes one step, and the second step breaks the invariant.
+  EXPECT_EQ(*bad_path, (std::vector<uint8_t>{0, 1}));
+  EXPECT_EQ(replay(*experiment, *bad_path).result,
+            ActionResult::kInvariantViolated);
+}
+
+TEST(ThreadPool, StepInvariantChecksTheInitialState)
+{
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        actions->add_action(
+            [](RunnableActionSet &set, int &x) -> Async {
+              x = -1;
+              co_await set.bg();
+              x = 1;
+            },
+            x);
+        return actions;
+      },
+      [](ActionResult res, int & /*x*/) { return res == ActionResult::kOk; });
+  experiment->set_invariant([](int &x) { return x >= 0; });
+
+  ThreadPool<int> pool(1);
+  auto bad_path = pool.run(experiment);
+  ASSERT_TRUE(bad_path);
+  EXPECT_TRUE(bad_path->empty());
+}
+
 TEST(ThreadPool, Stealing)
 {
   ThreadPool<int, int> pool(4);
@@ -108,6 +255,34 @@ TEST(ThreadPool, Stealing)
   EXPECT_TRUE(pool.run_test(experiment));
 }
 
+TEST(ThreadPool, RepeatedRuns)
+{
+  ThreadPool<int> pool(4);
+  std::shared_ptr<ExperimentBuilder<int>> experiment =
+      std::make_shared<ExperimentBuilder<int>>(
+          []() { return std::make_tuple(0); },
+          [](WorkQueue &work_queue, int &a) {
+            auto actions = std::make_unique<RunnableActionSet>(work_queue);
+            for (int i = 0; i < 3; i++) {
+              actions->add_action(
+                  [](RunnableActionSet &set, int &a) -> Async {
+                    co_await set.bg();
+                    a++;
+                  },
+                  a);
+            }
+            return actions;
+          },
+          [](ActionResult res, int &a) -> bool {
+            return res == ActionResult::kOk && a == 3;
+          });
+
+  // Each run starts as soon as the last one ends.
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(pool.run_test(experiment));
+  }
+}
+
 TEST(ThreadPool, NoWaitPointsEdgeCase)
 {
   ThreadPool<int, int> pool(4);
@@ -118,7 +293,7 @@ TEST(ThreadPool, NoWaitPointsEdgeCase)
             auto actions = std::make_unique<RunnableActionSet>(work_queue);
 
             actions->add_action(
-                [](RunnableActionSet &set, int &a, int &b) -> Async {
+                [](RunnableActionSet & /*set*/, int &a, int &b) -> Async {
                   b = 1;
                   a = 2;
                   co_return;
@@ -238,7 +413,7 @@ TEST(ThreadPool, FindBadPath)
                 a, b);
 
             actions->add_action(
-                [](RunnableActionSet &set, int &a, int &b) -> Async {
+                [](RunnableActionSet &set, int &a, int & /*b*/) -> Async {
                   co_await set.bg();
                   a = 2;
                   co_await set.bg();
@@ -265,4 +440,531 @@ TEST(ThreadPool, FindBadPath)
   EXPECT_EQ(bad_path.value(), std::vector<uint8_t>({1, 0, 0}));
 }
 
+TEST(ThreadPool, FindBadPathCancelsEveryWorker)
+{
+  static std::atomic<int> checked = 0;
+  checked = 0;
+  ThreadPool<int> pool(4);
+  std::shared_ptr<ExperimentBuilder<int>> experiment =
+      std::make_shared<ExperimentBuilder<int>>(
+          []() { return std::make_tuple(0); },
+          [](WorkQueue &work_queue, int &value) {
+            auto actions = std::make_unique<RunnableActionSet>(work_queue);
+            // Far too many interleavings to ever finish.
+            for (int i = 0; i < 10; i++) {
+              actions->add_action(
+                  [](RunnableActionSet &set, int &value) -> Async {
+                    co_await set.bg();
+                    value++;
+                    co_await set.bg();
+                    value++;
+                  },
+                  value);
+            }
+            return actions;
+          },
+          [](ActionResult res, int & /*value*/) -> bool {
+            checked++;
+            // Fails after a few paths, so that other workers are busy.
+            return res == ActionResult::kOk && checked < 20;
+          });
+
+  EXPECT_TRUE(pool.run(experiment).has_value());
+  // Every worker stops within a path of the failure.
+  EXPECT_LT(checked, 100);
+}
+
+TEST(ThreadPool, PartialOrderReduction)
+{
+  static std::atomic<size_t> paths = 0;
+  paths = 0;
+  ThreadPool<std::array<int, 6>> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<std::array<int, 6>>>(
+      []() { return std::make_tuple(std::array<int, 6>{}); },
+      [](WorkQueue &work_queue, std::array<int, 6> &values) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+
+        for (auto &value : values) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &value) -> Async {
+                co_await set.bg(Access::write(&value));
+                value += 1;
+                co_await set.bg(Access::write(&value));
+                value += 2;
+              },
+              value);
+        }
+        // Races with the first action only.
+        actions->add_action(
+            [](RunnableActionSet &set, std::array<int, 6> &values) -> Async {
+              co_await set.bg(Access::write(values.data()));
+              values[0] *= 2;
+            },
+            values);
+
+        return actions;
+      },
+      [](ActionResult res, std::array<int, 6> &values) -> bool {
+        paths++;
+        if (res != ActionResult::kOk) {
+          return false;
+        }
+        return (values[0] == 3 || values[0] == 4 || values[0] == 6) &&
+               values[1] == 3 && values[5] == 3;
+      });
+  experiment->set_search_options(
+      SearchOptions{.partial_order_reduction = true});
+
+  EXPECT_TRUE(pool.run_test(experiment));
+  // One trace per position of the racing step relative to the first action,
+  // plus any duplicates from stealing.  Without reduction, this would be
+  // 13!/2^6 (almost 100 million) interleavings.
+  EXPECT_GE(paths, 3);
+  EXPECT_LT(paths, 100);
+}
+
+TEST(ThreadPool, PartialOrderReductionFindBadPath)
+{
+  ThreadPool<int, int> pool(4);
+  std::shared_ptr<ExperimentBuilder<int, int>> experiment =
+      std::make_shared<ExperimentBuilder<int, int>>(
+          []() { return std::make_tuple(1, 2); },
+          [](WorkQueue &work_queue, int &a, int &b) {
+            auto actions = std::make_unique<RunnableActionSet>(work_queue);
+
+            actions->add_action(
+                [](RunnableActionSet &set, int &a, int &b) -> Async {
+                  co_await set.bg({Access::read(&a), Access::write(&b)});
+                  if (a == 2) {
+                    b = 3;
+                  }
+                },
+                a, b);
+
+            actions->add_action(
+                [](RunnableActionSet &set, int &a, int & /*unused*/) -> Async {
+                  co_await set.bg(Access::write(&a));
+                  a = 2;
+                  co_await set.bg(Access::write(&a));
+                  a = 3;
+                },
+                a, b);
+
+            return actions;
+          },
+          [](ActionResult res, int &a, int &b) -> bool {
+            if (res != ActionResult::kOk) {
+              return false;
+            }
+
+            return a == 3 && b == 2;
+          });
+  experiment->set_search_options(
+      SearchOptions{.partial_order_reduction = true});
+
+  auto bad_path = pool.run(experiment);
+  ASSERT_TRUE(bad_path.has_value());
+  // NOLINTNEXTLINE(bugprone-unchecked-optional-access)
+  EXPECT_EQ(bad_path.value(), std::vector<uint8_t>({1, 0, 0}));
+}
+
+TEST(ThreadPool, StatefulExploration)
+{
+  ThreadPool<std::array<int, 4>> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<std::array<int, 4>>>(
+      []() { return std::make_tuple(std::array<int, 4>{}); },
+      [](WorkQueue &work_queue, std::array<int, 4> &counters) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int &counter : counters) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &counter) -> Async {
+                for (int i = 0; i < 3; i++) {
+                  co_await set.bg();
+                  counter++;
+                }
+              },
+              counter);
+        }
+        return actions;
+      },
+      [](ActionResult res, std::array<int, 4> &counters) -> bool {
+        return res == ActionResult::kOk &&
+               counters == std::array<int, 4>{3, 3, 3, 3};
+      });
+  // 12!/(3!)^4 = 369600 interleavings, but only 4^4 = 256 states.
+  experiment->set_state_hash([](std::array<int, 4> &counters) -> uint64_t {
+    uint64_t hash = 0;
+    for (int counter : counters) {
+      hash = hash_combine(hash, counter);
+    }
+    return hash;
+  });
+
+  EXPECT_TRUE(pool.run_test(experiment));
+}
+
+TEST(ThreadPool, StatefulExplorationBitstate)
+{
+  ThreadPool<std::array<int, 4>> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<std::array<int, 4>>>(
+      []() { return std::make_tuple(std::array<int, 4>{}); },
+      [](WorkQueue &work_queue, std::array<int, 4> &counters) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int &counter : counters) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &counter) -> Async {
+                for (int i = 0; i < 3; i++) {
+                  co_await set.bg();
+                  counter++;
+                }
+              },
+              counter);
+        }
+        return actions;
+      },
+      [](ActionResult res, std::array<int, 4> &counters) -> bool {
+        return res == ActionResult::kOk &&
+               counters == std::array<int, 4>{3, 3, 3, 3};
+      });
+  experiment->set_state_hash(
+      [](std::array<int, 4> &counters) -> uint64_t {
+        uint64_t hash = 0;
+        for (int counter : counters) {
+          hash = hash_combine(hash, counter);
+        }
+        return hash;
+      },
+      StateTableOptions{.bitstate_bytes = 1 << 16});
+
+  EXPECT_TRUE(pool.run_test(experiment));
+  ASSERT_TRUE(pool.state_table_stats().has_value());
+  // NOLINTNEXTLINE(bugprone-unchecked-optional-access)
+  auto stats = *pool.state_table_stats();
+  // Every state but the initial and the final one, though two workers that
+  // reach a state at the same time may both count it.
+  EXPECT_LE(stats.states, 260);
+  EXPECT_GT(stats.states, 200);
+  EXPECT_LT(stats.omission_probability, 1e-6);
+}
+
+TEST(ThreadPool, StatefulExplorationFindBadPath)
+{
+  ThreadPool<int, int> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<int, int>>(
+      []() { return std::make_tuple(1, 2); },
+      [](WorkQueue &work_queue, int &a, int &b) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+
+        actions->add_action(
+            [](RunnableActionSet &set, int &a, int &b) -> Async {
+              co_await set.bg();
+              if (a == 2) {
+                b = 3;
+              }
+            },
+            a, b);
+
+        actions->add_action(
+            [](RunnableActionSet &set, int &a, int & /*unused*/) -> Async {
+              co_await set.bg();
+              a = 2;
+              co_await set.bg();
+              a = 3;
+            },
+            a, b);
+
+        return actions;
+      },
+      [](ActionResult res, int &a, int &b) -> bool {
+        return res == ActionResult::kOk && a == 3 && b == 2;
+      });
+  experiment->set_state_hash(
+      [](int &a, int &b) -> uint64_t { return hash_combine(a, b); });
+
+  auto bad_path = pool.run(experiment);
+  ASSERT_TRUE(bad_path.has_value());
+  // NOLINTNEXTLINE(bugprone-unchecked-optional-access)
+  EXPECT_EQ(bad_path.value(), std::vector<uint8_t>({1, 0, 0}));
+}
+
+TEST(ThreadPool, PreemptionBoundedFindsBug)
+{
+  ThreadPool<int> pool(4);
+  // Two unsynchronized increments: one update is lost if the other action
+  // preempts the first between its read and its write.
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 2; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                int tmp = x;
+                co_await set.bg();
+                x = tmp + 1;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x == 2;
+      });
+
+  auto bad_path = pool.run_preemption_bounded(experiment, 3);
+  ASSERT_TRUE(bad_path.has_value());
+  const auto &stats = pool.preemption_bound_stats();
+  ASSERT_EQ(stats.size(), 2);
+  // Without preemptions, each action runs to the end in turn.
+  EXPECT_EQ(stats[0].paths, 2);
+  EXPECT_TRUE(stats[0].hit_bound);
+  EXPECT_EQ(stats[1].max_preemptions, 1);
+
+  // The path replays without a bound.
+  EXPECT_EQ(pool.run(experiment, *bad_path), bad_path);
+}
+
+TEST(ThreadPool, PreemptionBoundedStopsOnceComplete)
+{
+  ThreadPool<int> pool(4);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x == 6;
+      });
+
+  EXPECT_FALSE(pool.run_preemption_bounded(experiment, 100));
+  const auto &stats = pool.preemption_bound_stats();
+  ASSERT_GE(stats.size(), 2);
+  EXPECT_EQ(stats[0].paths, 6);
+  for (size_t i = 1; i < stats.size(); i++) {
+    EXPECT_EQ(stats[i].max_preemptions, i);
+    EXPECT_GT(stats[i].paths, stats[i - 1].paths);
+  }
+  // The last bound explored all 6!/(2!2!2!) = 90 interleavings.
+  EXPECT_FALSE(stats.back().hit_bound);
+  EXPECT_EQ(stats.back().paths, 90);
+  EXPECT_TRUE(pool.run_test(experiment));
+  EXPECT_EQ(pool.paths(), 90);
+}
+
+TEST(ThreadPool, ProgressCallback)
+{
+  ThreadPool<int> pool(2);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        return res == ActionResult::kOk && x == 6;
+      });
+
+  std::vector<Progress> reports;
+  pool.set_progress_callback(
+      [&reports](const Progress &progress) { reports.push_back(progress); },
+      std::chrono::milliseconds(2));
+  EXPECT_TRUE(pool.run_test(experiment));
+  pool.set_progress_callback(nullptr);
+
+  // Reports come in every 2ms over about 20ms, and the last one is final.
+  ASSERT_GE(reports.size(), 2);
+  for (size_t i = 1; i < reports.size(); i++) {
+    EXPECT_GE(reports[i].paths, reports[i - 1].paths);
+  }
+  const auto &last = reports.back();
+  EXPECT_EQ(last.paths, 90);
+  EXPECT_DOUBLE_EQ(last.done, 1);
+  EXPECT_DOUBLE_EQ(last.estimated_paths, 90);
+}
+
+TEST(ThreadPool, ProgressOfPrefixedAndShardedRuns)
+{
+  ThreadPool<int> pool(3);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x == 6;
+      });
+
+  Progress last;
+  pool.set_progress_callback(
+      [&last](const Progress &progress) { last = progress; },
+      std::chrono::milliseconds(100));
+
+  // The weights count from the start of each run's own subtree.
+  EXPECT_FALSE(pool.run(experiment, std::vector<uint8_t>{1}));
+  EXPECT_EQ(last.paths, 30);
+  EXPECT_DOUBLE_EQ(last.done, 1);
+  EXPECT_DOUBLE_EQ(last.estimated_paths, 30);
+
+  for (size_t index = 0; index < 3; index++) {
+    EXPECT_FALSE(pool.run(experiment, Shard{.index = index, .count = 3}));
+    EXPECT_GT(last.paths, 0);
+    EXPECT_DOUBLE_EQ(last.done, 1);
+  }
+  pool.set_progress_callback(nullptr);
+}
+
+TEST(ThreadPool, CheckpointOnSigtermThenResume)
+{
+  static std::atomic<int> checked = 0;
+  checked = 0;
+  ThreadPool<int> pool(2);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x++;
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        if (++checked == 5) {
+          std::raise(SIGTERM);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return res == ActionResult::kOk && x == 6;
+      });
+
+  std::string path = ::testing::TempDir() + "threadpool_checkpoint";
+  pool.set_checkpoint_options({.path = path, .on_sigterm = true});
+  EXPECT_TRUE(pool.run_test(experiment));
+  ASSERT_TRUE(pool.interrupted());
+  size_t paths = pool.paths();
+  EXPECT_LT(paths, 90);
+
+  auto frontier = read_frontier(path);
+  ASSERT_TRUE(frontier);
+  EXPECT_FALSE(pool.resume(experiment, std::move(*frontier)));
+  EXPECT_FALSE(pool.interrupted());
+  // The workers stopped between paths, and nothing was stolen while the
+  // checkpoint was taken, so each path runs exactly once.
+  EXPECT_EQ(paths + pool.paths(), 90);
+
+  // A finished run leaves nothing to resume.
+  frontier = read_frontier(path);
+  ASSERT_TRUE(frontier);
+  EXPECT_TRUE(frontier->prefixes.empty());
+  pool.set_checkpoint_options({});
+  std::remove(path.c_str());
+}
+
+TEST(ThreadPool, ShardsSplitThePaths)
+{
+  ThreadPool<int> pool(2);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x) -> Async {
+                co_await set.bg();
+                x++;
+                co_await set.bg();
+                x += set.choice(2);
+              },
+              x);
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x >= 3;
+      });
+
+  // 90 interleavings, with 8 ways to make the choices each.
+  for (size_t depth : {0, 1, 3, 20}) {
+    size_t paths = 0;
+    for (size_t index = 0; index < 3; index++) {
+      Shard shard{.index = index, .count = 3, .depth = depth};
+      EXPECT_FALSE(pool.run(experiment, shard));
+      EXPECT_GT(pool.paths(), 0);
+      paths += pool.paths();
+    }
+    EXPECT_EQ(paths, 720);
+  }
+}
+
+TEST(ThreadPool, ShardFindsBadPath)
+{
+  ThreadPool<int> pool(2);
+  auto experiment = std::make_shared<ExperimentBuilder<int>>(
+      []() { return std::make_tuple(0); },
+      [](WorkQueue &work_queue, int &x) {
+        auto actions = std::make_unique<RunnableActionSet>(work_queue);
+        for (int i = 0; i < 3; i++) {
+          actions->add_action(
+              [](RunnableActionSet &set, int &x, int i) -> Async {
+                co_await set.bg();
+                x = x * 10 + i;
+              },
+              x, int{i});
+        }
+        return actions;
+      },
+      [](ActionResult res, int &x) -> bool {
+        return res == ActionResult::kOk && x != 210;
+      });
+
+  size_t found = 0;
+  for (size_t index = 0; index < 2; index++) {
+    if (auto bad_path =
+            pool.run(experiment, Shard{.index = index, .count = 2})) {
+      EXPECT_EQ(*bad_path, (std::vector<uint8_t>{2, 1, 0}));
+      found++;
+    }
+  }
+  EXPECT_EQ(found, 1);
+}
+
 } // namespace model
@@ -1,171 +1,668 @@
 #include "model_checker/work_queue.h"
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
-#include <type_traits>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "model_checker/metrics.h"
+
 namespace model {
 
-using ssize_t = std::make_signed_t<size_t>;
+namespace {
+
+constexpr uint64_t
+pack(uint32_t gen, uint32_t unclaimed)
+{
+  return (uint64_t{gen} << 32) | unclaimed;
+}
+
+constexpr uint32_t
+generation(uint64_t word)
+{
+  return word >> 32;
+}
+
+constexpr uint32_t
+unclaimed(uint64_t word)
+{
+  return static_cast<uint32_t>(word);
+}
+
+// The tracked alternatives numbered below `choice`.
+constexpr uint32_t
+below(uint8_t choice)
+{
+  return choice >= WorkQueue::kMaxBacktrackChoices
+             ? ~uint32_t{0}
+             : (uint32_t{1} << choice) - 1;
+}
+
+} // namespace
+
+WorkQueue::WorkQueue(std::vector<uint8_t> committed_choices,
+                     SearchOptions options)
+  : options_(options), committed_{.choices = std::move(committed_choices)},
+    root_{.height = committed_.choices.size()}
+{
+  if (options_.partial_order_reduction) {
+    // A caller-supplied prefix restricts the search to its subtree, so none of
+    // its alternatives are ours to backtrack into.
+    committed_.scheduled.assign(committed_.choices.size(), ~uint32_t{0});
+    committed_.explored.assign(committed_.choices.size(), 0);
+  }
+}
+
+WorkQueue::WorkQueue(std::vector<Prefix> frontier, SearchOptions options)
+  : options_(options), committed_(std::move(frontier.back()))
+{
+  const double weight = 1.0 / static_cast<double>(frontier.size());
+  frontier.pop_back();
+  for (auto &prefix : frontier) {
+    Root root{.height = prefix.choices.size(), .weight = weight};
+    pending_prefixes_.push_back(
+        PendingPrefix{.prefix = std::move(prefix), .root = root});
+  }
+  root_ = Root{.height = committed_.choices.size(), .weight = weight};
+  path_weight_ = weight;
+}
+
+WorkQueue::WorkQueue(Prefix prefix, Root root, SearchOptions options,
+                     const std::atomic<bool> *cancelled)
+  : options_(options), committed_(std::move(prefix)), root_(root),
+    path_weight_(root.weight), cancelled_(cancelled)
+{}
+
+WorkQueue::~WorkQueue()
+{
+  for (auto &chunk : chunks_) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+WorkQueue::Level &
+WorkQueue::level(size_t idx) const
+{
+  size_t chunk = std::bit_width(idx / kFirstChunkSize + 1) - 1;
+  size_t offset = idx - kFirstChunkSize * ((size_t{1} << chunk) - 1);
+  return chunks_[chunk].load(std::memory_order_acquire)[offset];
+}
+
+WorkQueue::Level &
+WorkQueue::new_level(size_t idx)
+{
+  size_t chunk = std::bit_width(idx / kFirstChunkSize + 1) - 1;
+  assert(chunk < kMaxChunks);
+  if (chunks_[chunk].load(std::memory_order_relaxed) == nullptr) {
+    chunks_[chunk].store(new Level[kFirstChunkSize << chunk],
+                         std::memory_order_release);
+  }
+  return level(idx);
+}
 
 std::unique_ptr<WorkQueue>
-WorkQueue::steal_work()
+WorkQueue::steal_work(const std::atomic<bool> *paused)
 {
   std::lock_guard lock(mtx_);
-  if (done_) {
+  if (done() || cancelled() || (paused != nullptr && paused->load())) {
     return nullptr;
   }
 
+  // Prefixes found by add_backtrack() are the shallowest work we have.
+  if (!pending_prefixes_.empty()) {
+    PendingPrefix pending = std::move(pending_prefixes_.back());
+    pending_prefixes_.pop_back();
+    return std::unique_ptr<WorkQueue>(new WorkQueue(
+        std::move(pending.prefix), pending.root, options_, cancelled_));
+  }
+
   // We steal from near the root of the tree, but the first branch point might
   // have been fully stolen and so we need to continue down to lower levels
-  std::vector<uint8_t> new_committed_choices = committed_choices_;
-  for (auto &[choice, next_choices] : passed_choices_) {
-    if (next_choices.empty()) {
-      new_committed_choices.push_back(choice);
+  size_t depth = depth_.load(std::memory_order_acquire);
+  for (size_t i = 0; i < depth; i++) {
+    Level &victim = level(i);
+    uint64_t word = victim.word.load(std::memory_order_acquire);
+    uint32_t end = unclaimed(word);
+    if (end == 0 || (!victim.backtrack_only.load(std::memory_order_acquire) &&
+                     victim.lo.load(std::memory_order_acquire) >= end)) {
       continue;
     }
 
-    new_committed_choices.push_back(next_choices.back());
-    next_choices.pop_back();
-    return std::make_unique<WorkQueue>(new_committed_choices);
+    // The owner might change the levels above while we read them, but then
+    // it has popped this level too, and the steal fails.
+    Prefix prefix = committed_;
+    for (size_t j = 0; j < i; j++) {
+      const Level &above = level(j);
+      prefix.choices.push_back(above.choice.load(std::memory_order_acquire));
+      if (options_.partial_order_reduction) {
+        prefix.scheduled.push_back(
+            above.scheduled.load(std::memory_order_acquire));
+        prefix.explored.push_back(
+            above.explored.load(std::memory_order_acquire));
+      }
+    }
+    uint32_t scheduled = victim.scheduled.load(std::memory_order_acquire);
+
+    auto choice = steal(victim, word);
+    if (!choice) {
+      continue;
+    }
+    if (options_.partial_order_reduction) {
+      prefix.scheduled.push_back(scheduled);
+      prefix.explored.push_back(scheduled & below(*choice));
+    }
+    prefix.choices.push_back(*choice);
+    return std::unique_ptr<WorkQueue>(
+        new WorkQueue(std::move(prefix), root_, options_, cancelled_));
   }
 
   return nullptr;
 }
 
 uint8_t
-WorkQueue::get_choice(uint8_t height, uint8_t n_opts)
+WorkQueue::get_choice(size_t height, uint8_t n_opts)
 {
-  assert(n_opts >= 1);
-  if (height < committed_choices_.size()) {
-    assert(committed_choices_[height] < n_opts);
-    return committed_choices_[height];
+  if (height >= root_.height) {
+    path_weight_ /= n_opts;
+  }
+  return choose(height, n_opts, false, 0, 0);
+}
+
+uint8_t
+WorkQueue::get_backtrack_choice(size_t height, uint8_t n_opts, uint8_t first,
+                                uint32_t sleeping)
+{
+  if (height >= root_.height) {
+    path_weight_ /= n_opts;
   }
+  return choose(height, n_opts, n_opts <= kMaxBacktrackChoices, first,
+                sleeping);
+}
+
+uint8_t
+WorkQueue::get_fixed_choice(size_t height, uint8_t n_opts, uint8_t choice)
+{
+  // A backtrack-only level where every other alternative counts as covered.
+  // Those are not part of the tree, so path_weight() stays as it is.
+  return choose(height, n_opts, true, choice, ~uint32_t{0});
+}
 
-  size_t pass_index = height - committed_choices_.size();
-  if (pass_index < passed_choices_.size()) {
-    assert(passed_choices_[pass_index].first < n_opts);
-    return passed_choices_[pass_index].first;
+uint8_t
+WorkQueue::choose(size_t height, uint8_t n_opts, bool backtrack_only,
+                  uint8_t first, uint32_t sleeping)
+{
+  metrics::PhaseTimer timer(Phase::kGetChoice);
+  assert(n_opts >= 1);
+  if (height < committed_.choices.size()) {
+    assert(committed_.choices[height] < n_opts);
+    return committed_.choices[height];
   }
 
-  std::lock_guard lock(mtx_);
+  size_t idx = height - committed_.choices.size();
+  if (idx < choices_.size()) {
+    assert(choices_[idx] < n_opts);
+    return choices_[idx];
+  }
 
-  assert(pass_index == passed_choices_.size());
-  std::vector<uint8_t> next_choices;
-  next_choices.reserve(n_opts - 1);
-  for (size_t i = 1; i < n_opts; i++) {
-    next_choices.push_back(n_opts - i);
+  assert(idx == choices_.size());
+  Level &next = new_level(idx);
+  uint32_t gen = generation(next.word.load(std::memory_order_relaxed));
+  uint8_t choice = 0;
+  // Thieves look at the rest of the level once they see the new word.
+  next.backtrack_only.store(backtrack_only, std::memory_order_release);
+  if (backtrack_only) {
+    assert(first < n_opts);
+    choice = first;
+    uint32_t scheduled =
+        (first < kMaxBacktrackChoices ? uint32_t{1} << first : 0) | sleeping;
+    next.scheduled.store(scheduled, std::memory_order_release);
+    next.explored.store(scheduled & below(first), std::memory_order_release);
+    next.word.store(pack(gen, 0), std::memory_order_release);
   }
-  passed_choices_.emplace_back(0, next_choices);
-  return 0;
+  else {
+    next.scheduled.store(~uint32_t{0}, std::memory_order_release);
+    next.explored.store(0, std::memory_order_release);
+    next.lo.store(1, std::memory_order_release);
+    next.word.store(pack(gen, n_opts), std::memory_order_release);
+  }
+  next.choice.store(choice, std::memory_order_release);
+  next.option_count.store(n_opts, std::memory_order_relaxed);
+  depth_.store(idx + 1, std::memory_order_release);
+  choices_.push_back(choice);
+  return choice;
 }
 
 void
-WorkQueue::advance_cursor()
+WorkQueue::add_backtrack(size_t height, uint32_t choices)
 {
-  std::lock_guard lock(mtx_);
+  assert(options_.partial_order_reduction);
+  assert(height < decision_count());
+  // Only branch points that explore every alternative have choices beyond
+  // kMaxBacktrackChoices, and those never need a backtrack point.
+  if (choices == 0) {
+    return;
+  }
+  const uint8_t choice = std::countr_zero(choices);
+  const uint32_t bit = uint32_t{1} << choice;
 
-  for (ssize_t i = passed_choices_.size() - 1; i >= 0; --i) {
-    auto &[choice, next_choices] = passed_choices_[i];
-    if (next_choices.empty()) {
-      // continue to a lower layer
-      passed_choices_.pop_back();
-      continue;
+  if (height < committed_.choices.size()) {
+    std::lock_guard lock(mtx_);
+    auto &scheduled = committed_.scheduled[height];
+    if ((scheduled & choices) != 0) {
+      return;
     }
 
-    choice = next_choices.back();
-    next_choices.pop_back();
+    Prefix prefix;
+    prefix.choices.assign(committed_.choices.begin(),
+                          committed_.choices.begin() + height);
+    prefix.choices.push_back(choice);
+    prefix.scheduled.assign(committed_.scheduled.begin(),
+                            committed_.scheduled.begin() + height + 1);
+    prefix.scheduled.back() |= bit;
+    prefix.explored.assign(committed_.explored.begin(),
+                           committed_.explored.begin() + height + 1);
+    prefix.explored.back() = scheduled & below(choice);
+    scheduled |= bit;
+    pending_prefixes_.push_back(
+        PendingPrefix{.prefix = std::move(prefix), .root = root_});
     return;
   }
-  // if we get all the way to committed_choices_, we must have finished
-  // the entire search tree
-  done_ = true;
+
+  Level &branch = level(height - committed_.choices.size());
+  uint32_t scheduled = branch.scheduled.load(std::memory_order_relaxed);
+  if ((scheduled & choices) != 0) {
+    return;
+  }
+  assert(branch.backtrack_only.load(std::memory_order_relaxed));
+  branch.scheduled.store(scheduled | bit, std::memory_order_release);
+  // Thieves might be claiming other alternatives at the same time.
+  uint64_t word = branch.word.load(std::memory_order_relaxed);
+  while (!branch.word.compare_exchange_weak(word, word | bit,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+  }
 }
 
-WorkQueueManager::WorkQueueManager(size_t n_work_queues,
-                                   std::vector<uint8_t> initial_path)
-  : work_queues_(n_work_queues)
+uint32_t
+WorkQueue::explored_before(size_t height) const
 {
-  work_queues_[0].work_ = std::make_shared<WorkQueue>(initial_path);
+  if (height < committed_.choices.size()) {
+    return committed_.explored[height];
+  }
+  return level(height - committed_.choices.size())
+      .explored.load(std::memory_order_relaxed);
 }
 
-void
-WorkQueueManager::mark_as_stealable(QueueState &state)
+std::optional<uint8_t>
+WorkQueue::claim(Level &level)
+{
+  uint64_t word = level.word.load(std::memory_order_relaxed);
+  if (level.backtrack_only.load(std::memory_order_relaxed)) {
+    while (unclaimed(word) != 0) {
+      uint64_t rest = word & (word - 1);
+      if (level.word.compare_exchange_weak(word, rest,
+                                           std::memory_order_relaxed)) {
+        return std::countr_zero(unclaimed(word));
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Thieves only ever lower the end of the range, so if it is empty now, it
+  // stays empty.
+  uint8_t choice = level.lo.load(std::memory_order_relaxed);
+  if (choice >= unclaimed(word)) {
+    return std::nullopt;
+  }
+  // The exchange orders the store before the load below, like the fence in
+  // Chase and Lev's deque, and is cheaper than a fence on x86.
+  level.lo.exchange(choice + 1, std::memory_order_seq_cst);
+  word = level.word.load(std::memory_order_seq_cst);
+  uint32_t end = unclaimed(word);
+  uint32_t next = uint32_t{choice} + 1;
+  if (next < end) {
+    return choice;
+  }
+  if (next == end &&
+      level.word.compare_exchange_strong(word,
+                                         pack(generation(word), choice),
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+    return choice;
+  }
+  // A thief took the last one.
+  return std::nullopt;
+}
+
+std::optional<uint8_t>
+WorkQueue::steal(Level &level, uint64_t word)
 {
+  if (level.backtrack_only.load(std::memory_order_acquire)) {
+    uint64_t rest = word & (word - 1);
+    if (unclaimed(word) != 0 &&
+        level.word.compare_exchange_strong(word, rest,
+                                           std::memory_order_acq_rel)) {
+      return std::countr_zero(unclaimed(word));
+    }
+    return std::nullopt;
+  }
+
+  // Reload the word in the same total order as the owner's exchange; `word`
+  // itself came from an acquire load.
+  if (level.word.load(std::memory_order_seq_cst) != word) {
+    return std::nullopt;
+  }
+  uint8_t lo = level.lo.load(std::memory_order_seq_cst);
+  uint32_t end = unclaimed(word);
+  if (lo >= end ||
+      !level.word.compare_exchange_strong(word, pack(generation(word), end - 1),
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+    return std::nullopt;
+  }
+  return end - 1;
+}
 
-  if (state.in_steal_queue_) {
+void
+WorkQueue::advance_cursor()
+{
+  metrics::PhaseTimer timer(Phase::kAdvanceCursor);
+  path_weight_ = root_.weight;
+  if (cancelled()) {
+    done_.store(true, std::memory_order_release);
     return;
   }
+  while (!choices_.empty()) {
+    Level &branch = level(choices_.size() - 1);
+    if (auto choice = claim(branch)) {
+      uint32_t scheduled = branch.scheduled.load(std::memory_order_relaxed);
+      branch.explored.store(scheduled & below(*choice),
+                            std::memory_order_release);
+      branch.choice.store(*choice, std::memory_order_release);
+      choices_.back() = *choice;
+      unchanged_prefix_ = decision_count() - 1;
+      return;
+    }
 
+    // continue to a lower layer
+    uint64_t word = branch.word.load(std::memory_order_relaxed);
+    branch.word.store(pack(generation(word) + 1, 0), std::memory_order_release);
+    choices_.pop_back();
+    depth_.store(choices_.size(), std::memory_order_release);
+  }
+  // if we get all the way to the committed prefix, we must have finished
+  // the entire search tree, unless add_backtrack() left us more prefixes.
   std::lock_guard lock(mtx_);
-  if (shortcircuit_done_) {
+  if (!pending_prefixes_.empty()) {
+    rebase();
     return;
   }
-  state.in_steal_queue_ = true;
-  stealable_set_.push(&state);
-  cv_.notify_all();
+  done_.store(true, std::memory_order_release);
+}
+
+uint8_t
+WorkQueue::option_count(size_t height) const
+{
+  assert(height >= committed_.choices.size() && height < decision_count());
+  return level(height - committed_.choices.size())
+      .option_count.load(std::memory_order_relaxed);
 }
 
 void
-WorkQueueManager::shortcircuit_done()
+WorkQueue::commit_current_path()
 {
+  assert(!options_.partial_order_reduction);
   std::lock_guard lock(mtx_);
-  stealable_set_ = {};
-  shortcircuit_done_ = true;
+  assert(pending_prefixes_.empty());
+  committed_.choices.insert(committed_.choices.end(), choices_.begin(),
+                            choices_.end());
+  for (size_t idx = 0; idx < choices_.size(); idx++) {
+    Level &branch = level(idx);
+    uint64_t word = branch.word.load(std::memory_order_relaxed);
+    branch.word.store(pack(generation(word) + 1, 0), std::memory_order_release);
+  }
+  choices_.clear();
+  depth_.store(0, std::memory_order_release);
+  unchanged_prefix_ = 0;
 }
 
-WorkQueue *
-WorkQueueManager::get_work_queue(size_t idx)
+void
+WorkQueue::rebase()
 {
-  assert(idx < work_queues_.size());
+  assert(choices_.empty());
+  committed_ = std::move(pending_prefixes_.back().prefix);
+  root_ = pending_prefixes_.back().root;
+  pending_prefixes_.pop_back();
+  path_weight_ = root_.weight;
+  unchanged_prefix_ = 0;
+}
 
-  if (work_queues_[idx].work_ != nullptr && !work_queues_[idx].work_->done()) {
-    return work_queues_[idx].work_.get();
+WorkQueueManager::WorkQueueManager(size_t n_work_queues,
+                                   std::vector<uint8_t> initial_path,
+                                   SearchOptions options)
+  : work_queues_(n_work_queues), idle_(n_work_queues - 1)
+{
+  assert(n_work_queues > 0);
+  work_queues_[0].work_ = std::make_shared<WorkQueue>(initial_path, options);
+  work_queues_[0].work_->set_cancel_flag(&cancelled_);
+  for (size_t i = 0; i < n_work_queues; i++) {
+    // Any distinct nonzero seeds will do.
+    work_queues_[i].rng_ = (i + 1) * 0x9e3779b97f4a7c15;
   }
+}
 
-  // This is kind of sketchy; in bad patterns we might wind up just spinning
-  // while waiting for one queue to find new choices, but I suspect this is good
-  // enough for most cases.
+WorkQueueManager::WorkQueueManager(size_t n_work_queues,
+                                   std::vector<WorkQueue::Prefix> frontier,
+                                   SearchOptions options)
+  : work_queues_(n_work_queues), idle_(n_work_queues)
+{
+  assert(n_work_queues > 0);
+  if (!frontier.empty()) {
+    work_queues_[0].work_ =
+        std::make_shared<WorkQueue>(std::move(frontier), options);
+    work_queues_[0].work_->set_cancel_flag(&cancelled_);
+    idle_--;
+  }
+  for (size_t i = 0; i < n_work_queues; i++) {
+    work_queues_[i].rng_ = (i + 1) * 0x9e3779b97f4a7c15;
+  }
+}
 
-  std::unique_lock lock(mtx_);
-  pending_steals_++;
+void
+WorkQueueManager::shortcircuit_done()
+{
+  cancelled_.store(true, std::memory_order_relaxed);
+  finish();
+}
 
-  auto done = [this]() { return (pending_steals_ == work_queues_.size()); };
+void
+WorkQueueManager::finish()
+{
+  done_.store(true, std::memory_order_release);
+  wake_epoch_.fetch_add(1);
+  wake_epoch_.notify_all();
+  // snapshot() stops waiting once the search is over.
+  std::lock_guard lock(snapshot_mtx_);
+  snapshot_cv_.notify_all();
+}
+
+std::optional<std::vector<WorkQueue::Prefix>>
+WorkQueueManager::snapshot(bool then_stop)
+{
+  std::unique_lock lock(snapshot_mtx_);
+  // One snapshot at a time.
+  snapshot_cv_.wait(lock, [this] {
+    return !snapshot_requested_.load(std::memory_order_relaxed) || done();
+  });
+  if (done()) {
+    return std::nullopt;
+  }
+  snapshot_requested_.store(true);
+  // Parked workers check for the request before they go back to sleep.
+  wake_epoch_.fetch_add(1);
+  wake_epoch_.notify_all();
+  snapshot_cv_.wait(lock, [this] {
+    return snapshot_arrivals_ == work_queues_.size() || done();
+  });
 
-  while (true) {
-    if (stealable_set_.empty()) {
-      cv_.wait(lock, [&]() { return !stealable_set_.empty() || done(); });
+  std::optional<std::vector<WorkQueue::Prefix>> out;
+  if (snapshot_arrivals_ == work_queues_.size()) {
+    out = std::move(snapshot_);
+    if (then_stop) {
+      cancelled_.store(true, std::memory_order_relaxed);
+      done_.store(true, std::memory_order_release);
     }
-    // If everyone is waiting to steal work, then nobody has work left and we
-    // must be done.
-    if (done()) {
-      assert(pending_steals_ == work_queues_.size());
-      cv_.notify_all();
-      return nullptr;
+  }
+  snapshot_.clear();
+  snapshot_arrivals_ = 0;
+  snapshot_requested_.store(false);
+  snapshot_epoch_++;
+  snapshot_cv_.notify_all();
+  return out;
+}
+
+void
+WorkQueueManager::join_snapshot(size_t idx)
+{
+  // Work only moves between queues by stealing, and steals stop once the
+  // snapshot is requested (see try_steal()).  A steal that got in before
+  // the victim joined has taken its subtree out of the victim's queue, and
+  // the thief adds it when it joins.
+  auto &self = work_queues_[idx];
+  std::vector<WorkQueue::Prefix> work;
+  if (self.work_ != nullptr && !self.work_->done()) {
+    work = self.work_->remaining_work();
+  }
+
+  std::unique_lock lock(snapshot_mtx_);
+  if (!snapshot_requested_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  std::ranges::move(work, std::back_inserter(snapshot_));
+  snapshot_arrivals_++;
+  uint64_t epoch = snapshot_epoch_;
+  snapshot_cv_.notify_all();
+  snapshot_cv_.wait(lock, [&] { return snapshot_epoch_ != epoch; });
+}
+
+void
+WorkQueueManager::wake_parked()
+{
+  wake_epoch_.fetch_add(1);
+  wake_epoch_.notify_one();
+}
+
+void
+WorkQueueManager::park()
+{
+  // Read the epoch before registering: anyone who sees us registered bumps it
+  // afterwards, so the wait below cannot miss them.
+  uint32_t epoch = wake_epoch_.load();
+  parked_.fetch_add(1);
+  if (!done() && !snapshot_requested_.load()) {
+    wake_epoch_.wait(epoch);
+  }
+  parked_.fetch_sub(1);
+}
+
+WorkQueue *
+WorkQueueManager::try_steal(size_t idx)
+{
+  metrics::PhaseTimer timer(Phase::kSteal);
+  auto &self = work_queues_[idx];
+  const size_t n_victims = work_queues_.size() - 1;
+  for (size_t probe = 0; probe < n_victims; probe++) {
+    // xorshift64*
+    self.rng_ ^= self.rng_ >> 12;
+    self.rng_ ^= self.rng_ << 25;
+    self.rng_ ^= self.rng_ >> 27;
+    size_t victim_idx = (self.rng_ * 0x2545f4914f6cdd1d >> 32) % n_victims;
+    if (victim_idx >= idx) {
+      victim_idx++;
+    }
+
+    std::shared_ptr<WorkQueue> victim;
+    {
+      std::lock_guard lock(work_queues_[victim_idx].mtx_);
+      victim = work_queues_[victim_idx].work_;
+    }
+    work_queues_[victim_idx].advertised_.store(false,
+                                               std::memory_order_relaxed);
+    if (victim == nullptr || victim->done()) {
+      continue;
+    }
+
+    // Count as busy before taking any work, so that nobody sees every worker
+    // idle while the work is in our hands.
+    idle_.fetch_sub(1);
+    // Not while a snapshot is taken, so that no subtree moves from a queue
+    // that has joined to one that has yet to.
+    auto ptr = victim->steal_work(&snapshot_requested_);
+    metrics::record([&ptr](Metrics &m) {
+      (ptr != nullptr ? m.steals : m.failed_steals)++;
+    });
+    if (ptr) {
+      std::lock_guard lock(self.mtx_);
+      self.work_ = std::move(ptr);
+      return self.work_.get();
+    }
+    idle_.fetch_add(1);
+  }
+  return nullptr;
+}
+
+WorkQueue *
+WorkQueueManager::get_work_queue(size_t idx)
+{
+  assert(idx < work_queues_.size());
+  auto &self = work_queues_[idx];
+
+  if (self.work_ != nullptr) {
+    if (!self.work_->done() && !cancelled_.load(std::memory_order_relaxed)) {
+      return self.work_.get();
+    }
+    {
+      std::lock_guard lock(self.mtx_);
+      self.work_ = nullptr;
     }
-    auto *steal_from = stealable_set_.front();
-    assert(steal_from);
-    assert(steal_from->work_);
+    idle_.fetch_add(1);
+  }
 
-    if (auto ptr = steal_from->work_->steal_work()) {
-      // not in steal queue because it's new work
-      work_queues_[idx].work_ = std::move(ptr);
-      work_queues_[idx].in_steal_queue_ = false;
-      assert(pending_steals_ > 0);
-      pending_steals_--;
-      return work_queues_[idx].work_.get();
+  uint32_t round = 0;
+  while (!done()) {
+    at_safe_point(idx);
+    // Work only comes from workers that have some, so if everyone is idle
+    // then nobody has work left and we must be done.
+    if (idle_.load() == work_queues_.size()) {
+      finish();
+      break;
+    }
+    if (auto *work_queue = try_steal(idx)) {
+      return work_queue;
+    }
+    metrics::PhaseTimer timer(Phase::kIdle);
+    if (round < kBackoffRounds) {
+      for (uint32_t i = 0; i < (uint32_t{1} << round); i++) {
+        std::this_thread::yield();
+      }
+      round++;
+    }
+    else {
+      park();
+      round = 0;
     }
-    // not in steal queue because it's popped from the queue
-    steal_from->in_steal_queue_ = false;
-    stealable_set_.pop();
   }
+  return nullptr;
 }
 
 std::vector<uint8_t>
@@ -173,15 +670,64 @@ WorkQueue::get_current_path() const
 {
   std::vector<uint8_t> path;
   path.reserve(decision_count());
-  for (const auto &choice : committed_choices_) {
-    path.push_back(choice);
-  }
-  for (auto const &[choice, _] : passed_choices_) {
+  for (const auto &choice : committed_.choices) {
     path.push_back(choice);
   }
+  path.insert(path.end(), choices_.begin(), choices_.end());
   return path;
 }
 
+std::vector<WorkQueue::Prefix>
+WorkQueue::remaining_work()
+{
+  // Keeps thieves out while we read the levels.
+  std::lock_guard lock(mtx_);
+  std::vector<Prefix> out;
+  for (const auto &pending : pending_prefixes_) {
+    out.push_back(pending.prefix);
+  }
+  if (done()) {
+    return out;
+  }
+
+  Prefix path = committed_;
+  for (size_t idx = 0; idx < choices_.size(); idx++) {
+    const Level &branch = level(idx);
+    uint64_t word = branch.word.load(std::memory_order_acquire);
+    uint32_t scheduled = branch.scheduled.load(std::memory_order_relaxed);
+    auto add = [&](uint8_t choice) {
+      Prefix alternative = path;
+      alternative.choices.push_back(choice);
+      if (options_.partial_order_reduction) {
+        alternative.scheduled.push_back(scheduled);
+        alternative.explored.push_back(scheduled & below(choice));
+      }
+      out.push_back(std::move(alternative));
+    };
+    if (branch.backtrack_only.load(std::memory_order_relaxed)) {
+      for (uint32_t rest = unclaimed(word); rest != 0; rest &= rest - 1) {
+        add(std::countr_zero(rest));
+      }
+    }
+    else {
+      for (uint32_t choice = branch.lo.load(std::memory_order_relaxed);
+           choice < unclaimed(word); choice++) {
+        add(choice);
+      }
+    }
+
+    path.choices.push_back(choices_[idx]);
+    if (options_.partial_order_reduction) {
+      path.scheduled.push_back(scheduled);
+      path.explored.push_back(
+          branch.explored.load(std::memory_order_relaxed));
+    }
+  }
+  // Last, so that a queue built from the frontier starts with it.
+  out.push_back(std::move(path));
+  return out;
+}
+
 std::string
 show_path(const std::vector<uint8_t> &path)
 {
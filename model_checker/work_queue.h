@@ -1,18 +1,33 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
 namespace model {
 
+// Options that shape how the search tree is explored.  They are fixed for a
+// whole exploration and inherited by work stolen from a queue.
+struct SearchOptions {
+  // Explore one interleaving per Mazurkiewicz trace instead of every
+  // interleaving.  Actions describe what each step touches with
+  // bg(access); see RunnableActionSet::bg().
+  bool partial_order_reduction = false;
+  // If set, paths switch away from an action that could have kept running
+  // at most this many times (a preemption bound, as in CHESS).  Switches
+  // after an action finishes are free.  Not supported together with partial
+  // order reduction.
+  std::optional<size_t> max_preemptions{};
+};
+
 // One thread's work to do on one (sub)tree of the search space.
 // Part of the queue can be stolen by another thread.
 // advance_cursor() iterates through paths.
@@ -20,10 +35,25 @@ namespace model {
 // on demand (as get_choice() is called).
 class WorkQueue {
 public:
+  // The root of a subtree: stolen, an alternative that add_backtrack() found
+  // inside the committed prefix, or part of the frontier that
+  // remaining_work() hands out.
+  struct Prefix {
+    std::vector<uint8_t> choices{};
+    // Per choice, the alternatives that were explored or scheduled there,
+    // and those that partial order reduction may sleep on (see
+    // explored_before()).  Empty unless partial order reduction is on.
+    std::vector<uint32_t> scheduled{};
+    std::vector<uint32_t> explored{};
+  };
+
   WorkQueue() = default;
-  WorkQueue(std::vector<uint8_t> committed_choices)
-    : committed_choices_(std::move(committed_choices))
-  {}
+  explicit WorkQueue(SearchOptions options) : options_(options) {}
+  WorkQueue(std::vector<uint8_t> committed_choices, SearchOptions options = {});
+  // Explores the subtrees below each of `frontier`, which must not be empty.
+  WorkQueue(std::vector<Prefix> frontier, SearchOptions options);
+
+  ~WorkQueue();
 
   // disable copy and move
   WorkQueue(const WorkQueue &) = delete;
@@ -33,75 +63,307 @@ public:
 
   // Work steal might still fail even if the work queue isn't done;
   // we might be in the middle of a computation and just haven't found a branch
-  // point yet
-  std::unique_ptr<WorkQueue> steal_work();
+  // point yet.  Steals nothing while `*paused` is set, which is checked under
+  // the same lock as remaining_work() takes, so a subtree never shows up both
+  // in remaining_work() and in a queue stolen after it.
+  std::unique_ptr<WorkQueue>
+  steal_work(const std::atomic<bool> *paused = nullptr);
 
   // Should only be called by the thread that owns the work queue.
-  uint8_t get_choice(uint8_t height, uint8_t n_opts);
+  uint8_t get_choice(size_t height, uint8_t n_opts);
+  // Like get_choice(), except that a new branch point only explores `first`.
+  // Other alternatives are explored once add_backtrack() asks for them, lowest
+  // first.  Choices in `sleeping` (a bitmask) are covered elsewhere and are
+  // never explored here.  Branch points with more than kMaxBacktrackChoices
+  // options are explored exhaustively.
+  uint8_t get_backtrack_choice(size_t height, uint8_t n_opts, uint8_t first = 0,
+                               uint32_t sleeping = 0);
+  // Like get_choice(), except that a new branch point only ever explores
+  // `choice`, so that the path still says which option was taken.
+  uint8_t get_fixed_choice(size_t height, uint8_t n_opts, uint8_t choice);
+  // Asks for one of `choices` (a bitmask) to be explored at the branch point
+  // at `height` on the current path, unless one of them was already explored
+  // or scheduled.  If that branch point is part of the committed (stolen)
+  // prefix, the alternative becomes a separate prefix that this queue explores
+  // (or gives away to thieves) once its own subtree is finished.
+  void add_backtrack(size_t height, uint32_t choices);
+  // Bitmask of the scheduled alternatives at `height` that are numbered below
+  // the current choice there.  Every alternative is explored by some queue,
+  // so partial order reduction may skip (sleep on) interleavings that they
+  // cover.
+  uint32_t explored_before(size_t height) const;
   // call when the current choice completes
   void advance_cursor();
-  bool done() const { return done_; }
+  bool done() const { return done_.load(std::memory_order_acquire); }
+
+  // Once `*cancelled` is set, this queue and every queue stolen from it stop:
+  // advance_cursor() finishes the queue, and RunnableActionSet stops the path
+  // that it is on.  The flag must outlive the queues.
+  void set_cancel_flag(const std::atomic<bool> *cancelled)
+  {
+    cancelled_ = cancelled;
+  }
+  bool cancelled() const
+  {
+    return cancelled_ != nullptr &&
+           cancelled_->load(std::memory_order_relaxed);
+  }
+
+  // Where the choice() calls that actions make before their first bg() go,
+  // for a path whose choices come from a source other than this queue (see
+  // RunnableActionSet::run(Source &)).  An action set picks it up when it is
+  // built, so `source` must outlive the action sets built on this queue.
+  struct ChoiceHook {
+    void *source = nullptr;
+    uint8_t (*choose)(void *source, size_t height, uint8_t option_count,
+                      uint32_t action) = nullptr;
+  };
+  template<typename Source> void set_choice_source(Source &source)
+  {
+    choice_hook_.source = &source;
+    choice_hook_.choose = [](void *source, size_t height,
+                             uint8_t option_count, uint32_t action) {
+      return static_cast<Source *>(source)->get_choice(height, option_count,
+                                                       action);
+    };
+  }
+  const ChoiceHook &choice_hook() const { return choice_hook_; }
 
   size_t decision_count() const
   {
-    return committed_choices_.size() + passed_choices_.size();
+    return committed_.choices.size() + choices_.size();
   }
 
   std::vector<uint8_t> get_current_path() const;
 
+  // The subtrees that this queue has yet to explore, including the one below
+  // the current path, which must not have started yet.  Should only be
+  // called by the owner between advance_cursor() and the next path.  Unless
+  // steals are paused (see steal_work()), a subtree that a thief steals at
+  // the same time may show up in both queues, but none goes missing.
+  std::vector<Prefix> remaining_work();
+
+  // The share of the search that the current path stands for, if every
+  // alternative at a branch point had an equally big subtree: the product of
+  // one over the option count of each choice made below the search's root.
+  // The root is the caller's prefix, or each prefix of a frontier, which all
+  // get the same share.  Summed over every path of a search, it comes to 1
+  // (see Progress).
+  double path_weight() const { return path_weight_; }
+  // For an owner that resumes the current path from state that it saved on
+  // an earlier path, instead of making the choices below the save again
+  // (see CheckpointedActionSet): restores what path_weight() was then.
+  void restore_path_weight(double weight) { path_weight_ = weight; }
+
+  // The number of choices at the start of the current path that are the same
+  // as on the previous path of this queue.  State from before those choices
+  // can be reused for this path (see CheckpointedActionSet).
+  size_t unchanged_prefix() const { return unchanged_prefix_; }
+
+  // The number of options at `height`, which must be past the committed
+  // prefix.
+  uint8_t option_count(size_t height) const;
+  // Commits to the current path: from now on, the queue only explores the
+  // subtree below it, and leaves the other alternatives on the way to it to
+  // whoever has a copy of the queue from before (see ForkEngine).  Nobody
+  // may steal from the queue.  Not supported with partial order reduction.
+  void commit_current_path();
+
+  const SearchOptions &options() const { return options_; }
+
+  static constexpr size_t kMaxBacktrackChoices = 32;
+
 private:
-  // steal_work can modify passed_choices_[i].second, but not .first or
-  // passed_choices_. advance_cursor can modify passed_choices_.  Hence, mtx_ is
-  // held during these methods. get_choice can modify passed_choices_ _if and
-  // only if_ we add a new choice, so get_choice only acquires the mutex in that
-  // scenario.
+  // A branch point on the current path.  Thieves read these while the owner
+  // moves on, so every field is atomic.  What a thief reads is only trusted
+  // if the generation in `word` has not changed by the time it claims an
+  // alternative: the owner bumps it whenever it pops the level, and it must
+  // pop a level before changing any level above it.
+  struct Level {
+    // The generation in the high 32 bits.  The low 32 bits are the
+    // unclaimed alternatives as a bitmask at backtrack-only levels, and one
+    // past the last unclaimed alternative at the others.
+    std::atomic<uint64_t> word = 0;
+    // The first unclaimed alternative at levels that are not backtrack-only.
+    // The owner claims from this end, without a compare-and-swap unless it
+    // races a thief for the last alternative, and thieves claim from the
+    // other end (Chase and Lev's work-stealing deque, on a range of choices).
+    std::atomic<uint8_t> lo = 0;
+    // The choice currently being explored.
+    std::atomic<uint8_t> choice = 0;
+    std::atomic<uint8_t> option_count = 0;
+    std::atomic<bool> backtrack_only = false;
+    // The alternatives that have been explored or scheduled (or that are
+    // covered elsewhere), so that add_backtrack() schedules each alternative
+    // at most once.  All bits are set at levels that explore every
+    // alternative.  Only alternatives below kMaxBacktrackChoices are tracked.
+    std::atomic<uint32_t> scheduled = 0;
+    // explored_before() for the current choice.
+    std::atomic<uint32_t> explored = 0;
+  };
+
+  // Levels live in chunks that double in size and are never moved or freed
+  // before the queue is, so that thieves can read them while the owner goes
+  // deeper.
+  static constexpr size_t kFirstChunkSize = 64;
+  static constexpr size_t kMaxChunks = 40;
+
+  // Where path_weight() starts: the choices below `height` come from the
+  // root of the search, and the subtree below them counts as `weight`.
+  struct Root {
+    size_t height = 0;
+    double weight = 1;
+  };
+  struct PendingPrefix {
+    Prefix prefix;
+    Root root;
+  };
+
+  WorkQueue(Prefix prefix, Root root, SearchOptions options,
+            const std::atomic<bool> *cancelled);
+
+  uint8_t choose(size_t height, uint8_t n_opts, bool backtrack_only,
+                 uint8_t first, uint32_t sleeping);
+  Level &level(size_t idx) const;
+  // Like level(), but allocates the chunk for `idx` if need be.
+  Level &new_level(size_t idx);
+  // Takes the next alternative at `level` for the owner.
+  static std::optional<uint8_t> claim(Level &level);
+  // Takes an alternative at `level` for a thief, if `word` is still current.
+  static std::optional<uint8_t> steal(Level &level, uint64_t word);
+  // Replaces the exhausted subtree with the next pending prefix.
+  void rebase();
+
+  // Only the owner changes the levels and depth_; see Level for how thieves
+  // read them.  mtx_ protects committed_ and pending_prefixes_, which the
+  // owner only changes when it backtracks into the committed prefix or
+  // finishes its subtree, and serializes thieves.
 
   std::mutex mtx_;
+  SearchOptions options_;
   // The work queue will be done once we finish exploring the search subtree
-  // that starts with this prefix.
-  const std::vector<uint8_t> committed_choices_;
-  // passed_choices_.first is the choice currently being explored.
-  // passed_choices_.second is the remaining choices to explore, at that branch.
-  // These might get stolen by another thread.
-  std::vector<std::pair<uint8_t, std::vector<uint8_t>>> passed_choices_;
-  bool done_ = false;
+  // that starts with this prefix (and any pending prefixes).  Only changes
+  // when the queue rebases onto a pending prefix.
+  Prefix committed_;
+  std::array<std::atomic<Level *>, kMaxChunks> chunks_{};
+  // The number of levels on the current path.
+  std::atomic<size_t> depth_ = 0;
+  // The owner's copy of the choices at each level, so that replaying a path
+  // touches nothing that thieves read.
+  std::vector<uint8_t> choices_;
+  std::vector<PendingPrefix> pending_prefixes_;
+  size_t unchanged_prefix_ = 0;
+  Root root_;
+  double path_weight_ = 1;
+  std::atomic<bool> done_ = false;
+  const std::atomic<bool> *cancelled_ = nullptr;
+  ChoiceHook choice_hook_;
 };
 
 std::string show_path(const std::vector<uint8_t> &path);
 
+// Hands out work to a fixed set of workers.  Idle workers steal directly from
+// random victims, backing off and eventually parking while nobody has work to
+// spare, so that there is no lock that every idle worker goes through.
 class WorkQueueManager {
 public:
   WorkQueueManager(size_t n_work_queues,
-                   std::vector<uint8_t> initial_path = {});
+                   std::vector<uint8_t> initial_path = {},
+                   SearchOptions options = {});
+  // Explores the subtrees below `frontier` (see WorkQueue::remaining_work()).
+  WorkQueueManager(size_t n_work_queues,
+                   std::vector<WorkQueue::Prefix> frontier,
+                   SearchOptions options);
 
   // Steals work if current work queue is done
   // returns nullptr if overall work is done
   WorkQueue *get_work_queue(size_t idx);
+  // Call after each path while the queue of `idx` still has work, so that
+  // a parked worker comes back to steal it.
   void mark_self_as_stealable(size_t idx)
   {
-    mark_as_stealable(work_queues_[idx]);
+    auto &self = work_queues_[idx];
+    if (parked_.load() != 0 &&
+        !self.advertised_.load(std::memory_order_relaxed)) {
+      self.advertised_.store(true, std::memory_order_relaxed);
+      wake_parked();
+    }
   }
 
-  bool done() const;
+  bool done() const { return done_.load(std::memory_order_acquire); }
 
+  // Stops handing out work, and cancels every queue (see
+  // WorkQueue::set_cancel_flag()), so that each worker stops within a path.
   void shortcircuit_done();
+  // Set by shortcircuit_done(), for queues that the manager does not hand
+  // out.
+  const std::atomic<bool> *cancel_flag() const { return &cancelled_; }
+
+  // Workers call this between paths, while they hold no half-explored path.
+  // If snapshot() is waiting, it adds the remaining work of the worker's
+  // queue to the snapshot, and blocks until the snapshot is complete.
+  void at_safe_point(size_t idx)
+  {
+    if (snapshot_requested_.load(std::memory_order_relaxed)) {
+      join_snapshot(idx);
+    }
+  }
+  // Waits for every worker to reach a safe point, and returns the work that
+  // they have left between them, or nullopt if the search finished first.
+  // If `then_stop`, the search is cancelled before the workers go on.  No
+  // work is stolen while the snapshot is taken, so every subtree that is
+  // left shows up exactly once.  Called by threads other than the workers,
+  // which take turns.
+  std::optional<std::vector<WorkQueue::Prefix>> snapshot(bool then_stop);
+
+  // Rounds of failed steals before an idle worker parks.  Round r yields the
+  // processor 2^r times before trying again.
+  static constexpr uint32_t kBackoffRounds = 8;
 
 private:
-  struct QueueState {
-    QueueState() = default;
+  // Padded so that workers do not share cache lines.
+  struct alignas(64) QueueState {
+    // Only the owner replaces work_, under mtx_.  Thieves copy it under mtx_,
+    // so that a queue outlives a steal from it.
+    std::mutex mtx_;
     std::shared_ptr<WorkQueue> work_ = nullptr;
-    std::atomic<bool> in_steal_queue_ = false;
+    // State of the owner's victim picker.
+    uint64_t rng_ = 0;
+    // Whether a parked worker was woken for this queue since a thief last
+    // looked at it.
+    std::atomic<bool> advertised_ = false;
   };
 
-  void mark_as_stealable(QueueState &state);
+  // One round of steal attempts from random victims.
+  WorkQueue *try_steal(size_t idx);
+  // Blocks until wake_parked() or finish().
+  void park();
+  // Wakes one parked worker.
+  void wake_parked();
+  void finish();
+  void join_snapshot(size_t idx);
 
   std::vector<QueueState> work_queues_;
 
-  std::mutex mtx_;
-  std::condition_variable cv_;
-  uint32_t pending_steals_ = 0;
-  std::queue<QueueState *> stealable_set_;
-  bool shortcircuit_done_ = false;
+  // The number of workers that have no work and are not stealing any.  Once
+  // it reaches the number of workers, nobody can make new work and we are
+  // done.
+  std::atomic<size_t> idle_;
+  std::atomic<bool> done_ = false;
+  std::atomic<bool> cancelled_ = false;
+  std::atomic<uint32_t> parked_ = 0;
+  // Bumped to wake parked workers.
+  std::atomic<uint32_t> wake_epoch_ = 0;
+
+  // Set while snapshot() waits for the workers.  snapshot_mtx_ protects the
+  // rest.
+  std::atomic<bool> snapshot_requested_ = false;
+  std::mutex snapshot_mtx_;
+  std::condition_variable snapshot_cv_;
+  std::vector<WorkQueue::Prefix> snapshot_;
+  size_t snapshot_arrivals_ = 0;
+  // Bumped when a snapshot is complete, which lets the workers go on.
+  uint64_t snapshot_epoch_ = 0;
 };
 
 } // namespace model
@@ -0,0 +1,55 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "model_checker/work_queue.h"
+
+namespace model {
+namespace {
+
+// Walks a complete tree of the given depth and fan-out, as the owner of a
+// queue that nobody steals from.
+void
+BM_WorkQueueOwnerPath(benchmark::State &state)
+{
+  const auto depth = static_cast<size_t>(state.range(0));
+  const auto fan_out = static_cast<uint8_t>(state.range(1));
+  size_t paths = 0;
+  for (auto _ : state) {
+    WorkQueue work_queue;
+    while (!work_queue.done()) {
+      for (size_t height = 0; height < depth; height++) {
+        benchmark::DoNotOptimize(work_queue.get_choice(height, fan_out));
+      }
+      work_queue.advance_cursor();
+      paths++;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+}
+BENCHMARK(BM_WorkQueueOwnerPath)->Args({8, 3})->Args({64, 1})->Args({2, 64});
+
+// Replays a long prefix on every path, as RunnableActionSet does.
+void
+BM_WorkQueueDeepReplay(benchmark::State &state)
+{
+  const auto depth = static_cast<size_t>(state.range(0));
+  size_t paths = 0;
+  for (auto _ : state) {
+    WorkQueue work_queue;
+    while (!work_queue.done()) {
+      for (size_t height = 0; height < depth; height++) {
+        benchmark::DoNotOptimize(
+            work_queue.get_choice(height, height + 1 == depth ? 16 : 1));
+      }
+      work_queue.advance_cursor();
+      paths++;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(paths));
+}
+BENCHMARK(BM_WorkQueueDeepReplay)->Arg(1000);
+
+} // namespace
+} // namespace model
@@ -1,9 +1,33 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "model_checker/work_queue.h"
 
 namespace model {
 
+namespace {
+
+// Orders paths as std::less would.  With std::less, GCC 12 warns about the
+// memcmp() inside vector's operator<=> in a Release build
+// (-Wstringop-overread).
+struct PathLess {
+  bool operator()(const std::vector<uint8_t> &a,
+                  const std::vector<uint8_t> &b) const
+  {
+    return std::ranges::lexicographical_compare(a, b);
+  }
+};
+using PathSet = std::set<std::vector<uint8_t>, PathLess>;
+
+} // namespace
+
 TEST(WorkQueue, Choices)
 {
   WorkQueue work_queue;
@@ -56,11 +80,13 @@ TEST(WorkQueue, StealWork)
     EXPECT_EQ(work->get_choice(2, 3), 0);
   }
 
+  // Thieves take the last alternatives at a branch point, and leave the
+  // owner to work its way up from the first.
   {
     auto work = work_queue.steal_work();
     ASSERT_TRUE(work);
     EXPECT_EQ(work->get_choice(0, 3), 1);
-    EXPECT_EQ(work->get_choice(1, 3), 1);
+    EXPECT_EQ(work->get_choice(1, 3), 2);
     EXPECT_EQ(work->get_choice(2, 3), 0);
   }
 
@@ -68,7 +94,7 @@ TEST(WorkQueue, StealWork)
     auto work = work_queue.steal_work();
     ASSERT_TRUE(work);
     EXPECT_EQ(work->get_choice(0, 3), 1);
-    EXPECT_EQ(work->get_choice(1, 3), 2);
+    EXPECT_EQ(work->get_choice(1, 3), 1);
     EXPECT_EQ(work->get_choice(2, 3), 0);
   }
 
@@ -77,7 +103,7 @@ TEST(WorkQueue, StealWork)
     ASSERT_TRUE(work);
     EXPECT_EQ(work->get_choice(0, 3), 1);
     EXPECT_EQ(work->get_choice(1, 3), 0);
-    EXPECT_EQ(work->get_choice(2, 3), 1);
+    EXPECT_EQ(work->get_choice(2, 3), 2);
   }
 
   {
@@ -85,7 +111,7 @@ TEST(WorkQueue, StealWork)
     ASSERT_TRUE(work);
     EXPECT_EQ(work->get_choice(0, 3), 1);
     EXPECT_EQ(work->get_choice(1, 3), 0);
-    EXPECT_EQ(work->get_choice(2, 3), 2);
+    EXPECT_EQ(work->get_choice(2, 3), 1);
 
     EXPECT_FALSE(work->done());
   }
@@ -103,4 +129,311 @@ TEST(WorkQueue, StealWork)
   EXPECT_FALSE(work_queue.steal_work());
 }
 
+TEST(WorkQueue, ConcurrentStealing)
+{
+  constexpr size_t kDepth = 6;
+  constexpr uint8_t kFanOut = 4;
+  constexpr size_t kThieves = 3;
+
+  WorkQueue work_queue;
+  auto explore = [](WorkQueue &queue, std::vector<std::vector<uint8_t>> &out) {
+    while (!queue.done()) {
+      for (size_t height = 0; height < kDepth; height++) {
+        queue.get_choice(height, kFanOut);
+      }
+      out.push_back(queue.get_current_path());
+      queue.advance_cursor();
+    }
+  };
+
+  std::vector<std::vector<std::vector<uint8_t>>> paths(kThieves + 1);
+  {
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < kThieves; i++) {
+      threads.emplace_back([&, i] {
+        while (!work_queue.done()) {
+          if (auto stolen = work_queue.steal_work()) {
+            explore(*stolen, paths[i]);
+          }
+        }
+      });
+    }
+    explore(work_queue, paths[kThieves]);
+  }
+
+  PathSet distinct;
+  size_t total = 0;
+  for (const auto &thread_paths : paths) {
+    distinct.insert(thread_paths.begin(), thread_paths.end());
+    total += thread_paths.size();
+  }
+  // 4^6 leaves, each explored exactly once.
+  EXPECT_EQ(total, 4096);
+  EXPECT_EQ(distinct.size(), 4096);
+}
+
+TEST(WorkQueue, StolenQueuesShareTheCancelFlag)
+{
+  std::atomic<bool> cancelled = false;
+  WorkQueue work_queue;
+  work_queue.set_cancel_flag(&cancelled);
+  EXPECT_EQ(work_queue.get_choice(0, 4), 0);
+
+  auto stolen = work_queue.steal_work();
+  ASSERT_TRUE(stolen);
+  EXPECT_FALSE(stolen->cancelled());
+
+  cancelled = true;
+  EXPECT_TRUE(work_queue.cancelled());
+  EXPECT_TRUE(stolen->cancelled());
+  EXPECT_FALSE(work_queue.steal_work());
+
+  work_queue.advance_cursor();
+  EXPECT_TRUE(work_queue.done());
+}
+
+TEST(WorkQueue, BacktrackChoices)
+{
+  WorkQueue work_queue(SearchOptions{.partial_order_reduction = true});
+
+  EXPECT_EQ(work_queue.get_backtrack_choice(0, 3), 0);
+  EXPECT_EQ(work_queue.get_choice(1, 2), 0);
+  EXPECT_EQ(work_queue.get_backtrack_choice(2, 3), 0);
+
+  // Only alternatives that were asked for get explored, and only once.  A
+  // request is satisfied by any one of its choices.
+  work_queue.add_backtrack(0, 0b100);
+  work_queue.add_backtrack(0, 0b110);
+  work_queue.add_backtrack(0, 0b1);
+
+  work_queue.advance_cursor();
+  EXPECT_EQ(work_queue.get_choice(1, 2), 1);
+  EXPECT_EQ(work_queue.get_backtrack_choice(2, 3), 0);
+
+  work_queue.advance_cursor();
+  EXPECT_EQ(work_queue.get_backtrack_choice(0, 3), 2);
+  EXPECT_EQ(work_queue.get_choice(1, 2), 0);
+  work_queue.add_backtrack(0, 0b1);
+
+  work_queue.advance_cursor();
+  EXPECT_EQ(work_queue.get_backtrack_choice(0, 3), 2);
+  EXPECT_EQ(work_queue.get_choice(1, 2), 1);
+
+  work_queue.advance_cursor();
+  EXPECT_TRUE(work_queue.done());
+}
+
+TEST(WorkQueue, BacktrackIntoStolenPrefix)
+{
+  WorkQueue work_queue(SearchOptions{.partial_order_reduction = true});
+
+  EXPECT_EQ(work_queue.get_backtrack_choice(0, 3), 0);
+  work_queue.add_backtrack(0, 0b10);
+  EXPECT_EQ(work_queue.get_backtrack_choice(1, 2), 0);
+
+  auto stolen = work_queue.steal_work();
+  ASSERT_TRUE(stolen);
+  EXPECT_EQ(stolen->get_backtrack_choice(0, 3), 1);
+  EXPECT_EQ(stolen->get_backtrack_choice(1, 2), 0);
+
+  // The thief asks for alternatives at a branch point that it does not own.
+  // The victim already explores choice 0 there, but nobody explores 2.
+  stolen->add_backtrack(0, 0b1);
+  stolen->add_backtrack(0, 0b100);
+  stolen->add_backtrack(1, 0b10);
+
+  stolen->advance_cursor();
+  EXPECT_EQ(stolen->get_backtrack_choice(0, 3), 1);
+  EXPECT_EQ(stolen->get_backtrack_choice(1, 2), 1);
+
+  // After its own subtree, the thief moves on to the new prefix.
+  stolen->advance_cursor();
+  EXPECT_FALSE(stolen->done());
+  EXPECT_EQ(stolen->get_backtrack_choice(0, 3), 2);
+  EXPECT_EQ(stolen->get_backtrack_choice(1, 2), 0);
+  EXPECT_EQ(stolen->get_current_path(), std::vector<uint8_t>({2, 0}));
+
+  stolen->advance_cursor();
+  EXPECT_TRUE(stolen->done());
+
+  work_queue.advance_cursor();
+  EXPECT_TRUE(work_queue.done());
+}
+
+TEST(WorkQueue, StealBacktrackPrefix)
+{
+  WorkQueue work_queue(std::vector<uint8_t>{1},
+                       SearchOptions{.partial_order_reduction = true});
+  EXPECT_EQ(work_queue.get_backtrack_choice(1, 2), 0);
+  EXPECT_EQ(work_queue.get_backtrack_choice(2, 2), 0);
+
+  // A caller-supplied prefix is never backtracked into.
+  work_queue.add_backtrack(0, 0b1);
+  EXPECT_FALSE(work_queue.steal_work());
+
+  work_queue.add_backtrack(1, 0b10);
+  auto stolen = work_queue.steal_work();
+  ASSERT_TRUE(stolen);
+  EXPECT_EQ(stolen->get_backtrack_choice(0, 2), 1);
+  EXPECT_EQ(stolen->get_backtrack_choice(1, 2), 1);
+  EXPECT_EQ(stolen->get_backtrack_choice(2, 2), 0);
+
+  // Choice 0 at height 1 is already explored by the victim.
+  stolen->add_backtrack(1, 0b1);
+  stolen->add_backtrack(2, 0b10);
+  stolen->advance_cursor();
+  EXPECT_EQ(stolen->get_backtrack_choice(2, 2), 1);
+  stolen->advance_cursor();
+  EXPECT_TRUE(stolen->done());
+
+  work_queue.advance_cursor();
+  EXPECT_TRUE(work_queue.done());
+}
+
+TEST(WorkQueue, RemainingWorkResumes)
+{
+  constexpr size_t kDepth = 3;
+  constexpr uint8_t kFanOut = 3;
+  PathSet paths;
+  auto explore = [&](WorkQueue &queue, size_t max_paths) {
+    for (size_t i = 0; i < max_paths && !queue.done(); i++) {
+      for (size_t height = 0; height < kDepth; height++) {
+        queue.get_choice(height, kFanOut);
+      }
+      EXPECT_TRUE(paths.insert(queue.get_current_path()).second);
+      queue.advance_cursor();
+    }
+  };
+
+  WorkQueue work_queue;
+  explore(work_queue, 4);
+  auto stolen = work_queue.steal_work();
+  ASSERT_TRUE(stolen);
+  explore(*stolen, 2);
+
+  // The stolen subtree stays with the thief.
+  auto remaining = work_queue.remaining_work();
+  WorkQueue resumed(std::move(remaining), {});
+  explore(resumed, 27);
+  EXPECT_TRUE(resumed.done());
+  explore(*stolen, 27);
+  EXPECT_EQ(paths.size(), 27);
+}
+
+TEST(WorkQueueManager, WorkersCoverEveryPath)
+{
+  constexpr size_t kDepth = 5;
+  constexpr uint8_t kFanOut = 4;
+  constexpr size_t kWorkers = 8;
+
+  WorkQueueManager manager(kWorkers);
+  std::vector<std::vector<std::vector<uint8_t>>> paths(kWorkers);
+  {
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < kWorkers; i++) {
+      threads.emplace_back([&, i] {
+        while (auto *queue = manager.get_work_queue(i)) {
+          for (size_t height = 0; height < kDepth; height++) {
+            queue->get_choice(height, kFanOut);
+          }
+          paths[i].push_back(queue->get_current_path());
+          queue->advance_cursor();
+          if (!queue->done()) {
+            manager.mark_self_as_stealable(i);
+          }
+        }
+      });
+    }
+  }
+  EXPECT_TRUE(manager.done());
+
+  PathSet distinct;
+  size_t total = 0;
+  for (const auto &worker_paths : paths) {
+    distinct.insert(worker_paths.begin(), worker_paths.end());
+    total += worker_paths.size();
+  }
+  EXPECT_EQ(total, 1024);
+  EXPECT_EQ(distinct.size(), 1024);
+}
+
+TEST(WorkQueueManager, ShortcircuitCancelsEveryQueue)
+{
+  WorkQueueManager manager(2);
+  auto *queue = manager.get_work_queue(0);
+  ASSERT_NE(queue, nullptr);
+  EXPECT_EQ(queue->get_choice(0, 2), 0);
+
+  manager.shortcircuit_done();
+  EXPECT_TRUE(manager.done());
+  EXPECT_TRUE(queue->cancelled());
+  EXPECT_EQ(manager.get_work_queue(1), nullptr);
+  EXPECT_EQ(manager.get_work_queue(0), nullptr);
+}
+
+TEST(WorkQueueManager, SnapshotThenResume)
+{
+  constexpr size_t kDepth = 7;
+  constexpr uint8_t kFanOut = 4;
+  constexpr size_t kWorkers = 8;
+
+  std::vector<PathSet> paths(kWorkers);
+  std::atomic<size_t> started = 0;
+  auto explore = [&](WorkQueueManager &manager) {
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < kWorkers; i++) {
+      threads.emplace_back([&, i] {
+        while (auto *queue = manager.get_work_queue(i)) {
+          for (size_t height = 0; height < kDepth; height++) {
+            queue->get_choice(height, kFanOut);
+          }
+          paths[i].insert(queue->get_current_path());
+          started.fetch_add(1);
+          started.notify_all();
+          queue->advance_cursor();
+          manager.at_safe_point(i);
+          if (!queue->done()) {
+            manager.mark_self_as_stealable(i);
+          }
+        }
+      });
+    }
+  };
+
+  std::vector<WorkQueue::Prefix> frontier;
+  {
+    WorkQueueManager manager(kWorkers);
+    std::jthread snapshotter([&] {
+      for (size_t n = started.load(); n < 64; n = started.load()) {
+        started.wait(n);
+      }
+      // One snapshot that lets the workers go on, and one that stops them.
+      // Either finds nothing if the workers happen to finish first.
+      manager.snapshot(false);
+      frontier = manager.snapshot(true).value_or(frontier);
+    });
+    explore(manager);
+  }
+
+  WorkQueueManager resumed(kWorkers, std::move(frontier), {});
+  explore(resumed);
+  EXPECT_TRUE(resumed.done());
+
+  PathSet distinct;
+  for (const auto &worker_paths : paths) {
+    distinct.insert(worker_paths.begin(), worker_paths.end());
+  }
+  EXPECT_EQ(distinct.size(), 16384);
+}
+
+TEST(WorkQueueManager, SnapshotAfterTheSearch)
+{
+  WorkQueueManager manager(2);
+  auto *queue = manager.get_work_queue(0);
+  ASSERT_NE(queue, nullptr);
+  queue->advance_cursor();
+  EXPECT_EQ(manager.get_work_queue(0), nullptr);
+  EXPECT_EQ(manager.snapshot(true), std::nullopt);
+}
+
 } // namespace model